@@ -0,0 +1,51 @@
+/*
+ * Native compile hook plugins for eryn.
+ *
+ * A plugin is a shared library that exports a 'transform' function with C linkage. To use it,
+ * set the 'compileHook' option to the path of the library instead of a JavaScript function.
+ *
+ * The transform is called for the same segments as the JavaScript hook (see the 'origin' values
+ * in index.d.ts). It doesn't run on the JavaScript thread, and may be called from several threads
+ * at once, so it must be thread-safe.
+ */
+
+#ifndef ERYN_PLUGIN_H_GUARD
+#define ERYN_PLUGIN_H_GUARD
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+    #define ERYN_PLUGIN_EXTERN extern "C"
+#else
+    #define ERYN_PLUGIN_EXTERN
+#endif
+
+#ifdef _WIN32
+    #define ERYN_PLUGIN_EXPORT ERYN_PLUGIN_EXTERN __declspec(dllexport)
+#else
+    #define ERYN_PLUGIN_EXPORT ERYN_PLUGIN_EXTERN __attribute__((visibility("default")))
+#endif
+
+/* The transform returns one of these. Anything else is treated as an invalid result, and fails the compilation. */
+#define ERYN_TRANSFORM_KEEP    0 /* The segment stays as it is (whatever was written is ignored). */
+#define ERYN_TRANSFORM_REPLACE 1 /* The segment is replaced by whatever was written (can be nothing). */
+
+/* Receives the transformed segment. 'write' can be called any number of times, and appends to the output. */
+typedef struct eryn_writer {
+    void* target;
+    void (*write)(void* target, const uint8_t* data, size_t size);
+} eryn_writer;
+
+typedef int (*eryn_transform_fn)(const char* origin, const uint8_t* in, size_t in_len, eryn_writer* out);
+
+/*
+ * Plugins implement it like this:
+ *
+ * ERYN_PLUGIN_EXPORT int transform(const char* origin, const uint8_t* in, size_t in_len, eryn_writer* out) {
+ *     ...
+ * }
+ */
+#define ERYN_PLUGIN_TRANSFORM_SYMBOL "transform"
+
+#endif
@@ -1,7 +1,9 @@
 // Type definitions for eryn 0.3
 // Definitions by UnexomWid <https://uw.exom.dev>
 
-type Hook = (content: Buffer, origin:
+import { Readable } from 'stream';
+
+type HookOrigin =
     'plaintext'
     | 'template'
     | 'void'
@@ -11,7 +13,12 @@ type Hook = (content: Buffer, origin:
     | 'loop_iterator'
     | 'loop_iterable'
     | 'component_path'
-    | 'component_context') => Buffer;
+    | 'component_context';
+
+type Hook = (content: Buffer, origin: HookOrigin) => Buffer;
+
+// Used when batchCompileHook is set. Receives all segments of a file at once, and returns one result for each.
+type BatchHook = (segments: { content: Buffer, origin: HookOrigin }[]) => (Buffer | string | null | undefined)[];
 
 interface ErynOptions {
     bypassCache?:              boolean,
@@ -23,6 +30,18 @@ interface ErynOptions {
     enableDeepCloning?:        boolean,
     cloneIterators?:           boolean,
     debugDumpOSH?:             boolean,
+    inlineStaticComponents?:   boolean,
+    mergePlaintext?:           boolean,
+    foldConstants?:            boolean,
+    minifyHTML?:               boolean,
+    batchCompileHook?:         boolean,
+    memoizeCompileHook?:       boolean,
+    // Reuses the output of side-effect free components rendered with the same context (in the same render). The context is
+    // still evaluated and serialized every time to look up the output, so this is slower for tiny components (e.g. an icon
+    // made of one template), and only pays off for components that take longer to render than their context takes to serialize.
+    memoizeComponents?:        boolean,
+    inlineThreshold?:          number,
+    defines?:                  { [name: string]: string | number | boolean | null },
     mode?:                     "normal" | "strict",
     workingDirectory?:         string,
     templateEscape?:           string,
@@ -42,7 +61,74 @@ interface ErynOptions {
     componentStart?:           string,
     componentSeparator?:       string,
     componentSelf?:            string,
-    compileHook?:              Hook
+    compileHook?:              Hook | BatchHook | string // A string is the path of a native plugin (see include/eryn_plugin.h).
+}
+
+interface RenderOptions {
+    timeout?:  number,                 // In milliseconds. The render is aborted with an error (see RenderAbortedError) if it takes longer.
+    deadline?: number,                 // Same as timeout, but as a timestamp (like Date.now()).
+    signal?:   { aborted: boolean }    // Checked before rendering (and between the slices/chunks of async renders and streams).
+}
+
+interface SharedRenderOptions extends RenderOptions {
+    shareStatic?: boolean // Templates without holes return a buffer that points into the engine cache, which must not be modified.
+}
+
+interface IntoOptions extends RenderOptions {
+    overflow?: (rest: Buffer) => void // Receives the output that didn't fit. If not set, ERYN_OUTPUT_OVERFLOW is thrown instead.
+}
+
+interface BatchItem {
+    path:     string,
+    context?: any,
+    shared?:  any
+}
+
+interface BatchOptions extends SharedRenderOptions { // The timeout is for the whole batch.
+    concat?: boolean // Renders all the items to a single buffer.
+}
+
+interface BatchOutput {
+    buffer:  Buffer,
+    offsets: number[] // Where each item starts in the buffer, and the end of the buffer as the last offset.
+}
+
+interface SitePage {
+    template: string,
+    data?:    string, // JSON file with the context.
+    output:   string
+}
+
+interface SiteOptions {
+    shared?: any,
+    force?:  boolean  // Writes the outputs even if they are the same as the existing files.
+}
+
+interface SiteStats {
+    rendered: number,
+    written:  number,
+    skipped:  number, // Outputs that were the same as the existing files.
+    bytes:    number  // Of the written outputs.
+}
+
+interface RenderProgress {
+    bytes:      number,
+    iterations: number, // Loop iterations.
+    components: number,
+    elapsed:    number  // In milliseconds.
+}
+
+interface RenderAbortedError extends Error {
+    code:     'ERYN_RENDER_ABORTED',
+    progress: RenderProgress
+}
+
+interface AsyncOptions extends RenderOptions {
+    timeSlice?: number // How long the render runs before letting other work run, in milliseconds (5 by default).
+}
+
+interface StreamOptions extends RenderOptions {
+    chunkSize?: number // In bytes (16384 by default). Chunks can be a bit larger, and the first one can be smaller.
 }
 
 declare class ErynBinding {
@@ -51,12 +137,46 @@ declare class ErynBinding {
     compileDir(dirPath: string, filters: string[]): void;
     compileString(alias: string, str: string): void;
     express(path: string, context: any, callback: (error: any, rendered: string) => void): void;
-    render(filePath: string, context: any, shared: any): Buffer;
-    renderString(alias: string, context: any, shared: any): Buffer;
+    render(filePath: string, context: any, shared: any, options?: SharedRenderOptions): Buffer;
+    renderSegments(filePath: string, context: any, shared: any, options?: RenderOptions): Buffer[]; // The buffers must not be modified.
+    renderAsync(filePath: string, context: any, shared: any, options?: AsyncOptions): Promise<Buffer>; // Same as render.
+    renderInto(filePath: string, context: any, target: Buffer, offset?: number, shared?: any, options?: IntoOptions): number; // Bytes written to the target.
+    renderMany(items: BatchItem[], options?: BatchOptions): Buffer[]; // Same as render, for each item.
+    renderMany(items: BatchItem[], options: BatchOptions & { concat: true }): BatchOutput;
+    renderStream(filePath: string, context: any, shared: any, options?: StreamOptions): Readable;
+    renderString(alias: string, context: any, shared: any, options?: SharedRenderOptions): Buffer; // Same as render.
     renderStringUncached(src: string, context: any, shared: any): Buffer;
+    buildSite(manifest: SitePage[], options?: SiteOptions): SiteStats;
+    freezeShared(shared: any): void;
     setOptions(options: ErynOptions): void;
 }
 
+// Allocations counted since the last reset (reallocations included), grouped by 'who' tag.
+interface MemoryStats {
+    count: number,
+    bytes: number,
+    live:  number, // Bytes currently allocated.
+    who:   { [tag: string]: { count: number, bytes: number } }
+}
+
+interface OutputPoolStats {
+    hits:     number, // Renders that got a recycled block.
+    misses:   number, // Renders that allocated a new block.
+    recycled: number, // Blocks given back to the pool (when their buffers were collected).
+    freed:    number, // Blocks freed instead (the pool was full).
+    blocks:   number, // Blocks in the pool.
+    bytes:    number,
+    external: number  // Bytes held by rendered buffers (reported to V8 as external memory).
+}
+
 declare function eryn(options: ErynOptions | undefined): ErynBinding;
+
+declare namespace eryn {
+    const outputPoolStats: () => OutputPoolStats;
+
+    // Only present in builds configured with ERYN_MEMORY_STATS.
+    const memoryStats:      (() => MemoryStats) | undefined;
+    const resetMemoryStats: (() => void) | undefined;
+}
   
 export = eryn;
@@ -1,5 +1,11 @@
-var { ErynEngine } = require('./build-load')(__dirname);
+var binding = require('./build-load')(__dirname);
+var { ErynEngine } = binding;
 const v8 = require('v8');
+const { Readable } = require('stream');
+const { resolve } = require('path');
+
+const DEFAULT_CHUNK_SIZE = 16384;
+const DEFAULT_TIME_SLICE = 5; // Milliseconds.
 
 function bridgeDeepClone(obj) {
     return v8.deserialize(v8.serialize(obj));
@@ -9,6 +15,51 @@ function bridgeShallowClone(obj) {
     return Object.assign({}, obj);
 }
 
+function deepFreeze(obj) {
+    Object.freeze(obj);
+
+    for(const key of Object.getOwnPropertyNames(obj)) {
+        const value = obj[key];
+
+        if(value && (typeof value === 'object') && !Object.isFrozen(value))
+            deepFreeze(value);
+    }
+
+    return obj;
+}
+
+// Same shape as the errors of renders that the engine aborts (but without progress, since nothing was rendered).
+function abortedError(reason) {
+    const error = new Error(`Render aborted (${reason})`);
+
+    error.code = 'ERYN_RENDER_ABORTED';
+    error.progress = { bytes: 0, iterations: 0, components: 0, elapsed: 0 };
+
+    return error;
+}
+
+// Converts options.timeout (milliseconds) and options.deadline (a Date.now() timestamp) to the timeout
+// that the engine checks (0 for none). Throws if the deadline passed, or if options.signal was aborted.
+function renderTimeout(options) {
+    if(!options)
+        return 0;
+    if(options.signal && options.signal.aborted)
+        throw abortedError('signal aborted');
+
+    let timeout = options.timeout > 0 ? options.timeout : 0;
+
+    if(typeof options.deadline === 'number') {
+        const remaining = options.deadline - Date.now();
+
+        if(remaining <= 0)
+            throw abortedError('deadline exceeded');
+
+        timeout = timeout > 0 ? Math.min(timeout, remaining) : remaining;
+    }
+
+    return timeout;
+}
+
 function bridgeEval(script, context, local, shared) {
     return eval(script);
 }
@@ -20,6 +71,7 @@ class ErynBinding {
         }
 
         this.binding = new ErynEngine(options);
+        this.frozenShared = undefined;
         this.bridgeOptions = {
             enableDeepCloning: false
         };
@@ -57,34 +109,225 @@ class ErynBinding {
         this.binding.compileString(alias, str);
     }
 
+    // Express needs the whole page for its callback, so the chunks are joined. To send the page while it's
+    // being rendered, pipe renderStream into the response instead.
     express(path, context, callback) {
+        const chunks = [];
+        let stream;
+
         try {
-            callback(null, this.binding.render(path, context));
+            stream = this.renderStream(path, context);
         } catch (error) {
             callback(error, null);
+            return;
         }
+
+        stream.on('data', (chunk) => chunks.push(chunk));
+        stream.on('end', () => callback(null, Buffer.concat(chunks).toString()));
+        stream.on('error', (error) => callback(error, null));
     }
 
-    render(path, context, shared) {
+    // With options.shareStatic, templates without holes render to a buffer that points into the engine cache (instead of a copy),
+    // so it must not be modified.
+    // With options.timeout or options.deadline, a render that takes too long throws an error with code ERYN_RENDER_ABORTED.
+    render(path, context, shared, options) {
         if(!(path && (typeof path === 'string' && !(path instanceof String))))
             throw `Invalid argument 'path' (expected: string | found: ${typeof(path)})`
         if(!context)
             context = {};
         if(!shared)
-            shared = {};
+            shared = this.frozenShared || {};
         
-        return this.binding.render(path, context, {}, shared, bridgeEval, this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone);
+        return this.binding.render(path, context, {}, shared, bridgeEval, this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone, renderTimeout(options),
+                                   !!(options && options.shareStatic));
     }
 
-    renderString(alias, context, shared) {
+    // Same as render, but returns the output as an array of buffers (e.g. for writev or a corked socket).
+    // Large static parts point directly into the engine cache, so the buffers must not be modified.
+    renderSegments(path, context, shared, options) {
+        if(!(path && (typeof path === 'string' && !(path instanceof String))))
+            throw `Invalid argument 'path' (expected: string | found: ${typeof(path)})`
+        if(!context)
+            context = {};
+        if(!shared)
+            shared = this.frozenShared || {};
+
+        return this.binding.renderSegments(path, context, {}, shared, bridgeEval, this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone, renderTimeout(options));
+    }
+
+    // Same as render, but the render runs in slices of about options.timeSlice milliseconds, and continues
+    // on setImmediate (so that other requests aren't blocked by a large render). Returns a promise of the output.
+    renderAsync(path, context, shared, options) {
+        if(!(path && (typeof path === 'string' && !(path instanceof String))))
+            return Promise.reject(`Invalid argument 'path' (expected: string | found: ${typeof(path)})`);
+        if(!context)
+            context = {};
+        if(!shared)
+            shared = this.frozenShared || {};
+
+        const timeSlice = (options && options.timeSlice > 0) ? options.timeSlice : DEFAULT_TIME_SLICE;
+        const signal = options && options.signal;
+        const binding = this.binding;
+        const clone = this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone;
+
+        return new Promise((resolve, reject) => {
+            let handle;
+
+            const step = () => {
+                try {
+                    if(signal && signal.aborted)
+                        throw abortedError('signal aborted');
+
+                    const result = binding.streamNext(handle);
+
+                    if(result === undefined)
+                        setImmediate(step);
+                    else
+                        resolve(result);
+                } catch (error) {
+                    reject(error);
+                }
+            };
+
+            try {
+                handle = binding.renderStream(path, context, {}, shared, bridgeEval, clone, 0, Math.ceil(timeSlice * 1000), renderTimeout(options));
+            } catch (error) {
+                reject(error);
+                return;
+            }
+
+            step();
+        });
+    }
+
+    // Same as render, but the output is streamed in chunks of about options.chunkSize bytes, as they are rendered.
+    // The static beginning of the template is sent before anything is evaluated. Rendering pauses while the stream is full.
+    renderStream(path, context, shared, options) {
+        if(!(path && (typeof path === 'string' && !(path instanceof String))))
+            throw `Invalid argument 'path' (expected: string | found: ${typeof(path)})`
+        if(!context)
+            context = {};
+        if(!shared)
+            shared = this.frozenShared || {};
+
+        const chunkSize = (options && options.chunkSize > 0) ? options.chunkSize : DEFAULT_CHUNK_SIZE;
+        const signal = options && options.signal;
+        const binding = this.binding;
+        const handle = binding.renderStream(path, context, {}, shared, bridgeEval, this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone,
+                                            chunkSize, 0, renderTimeout(options));
+
+        return new Readable({
+            highWaterMark: chunkSize,
+            read() {
+                try {
+                    if(signal && signal.aborted)
+                        throw abortedError('signal aborted');
+
+                    while(true) {
+                        const chunk = binding.streamNext(handle);
+
+                        if(chunk === null) {
+                            this.push(null);
+                            break;
+                        }
+                        if(!this.push(chunk))
+                            break;
+                    }
+                } catch (error) {
+                    this.destroy(error);
+                }
+            }
+        });
+    }
+
+    // Same as render, but writes the output to target (starting at offset), and returns the number of bytes written.
+    // If the output doesn't fit, target is filled and options.overflow is called with a buffer that has the rest of it.
+    // Without options.overflow, an error with code ERYN_OUTPUT_OVERFLOW is thrown instead (error.needed is the size of the output).
+    renderInto(path, context, target, offset, shared, options) {
+        if(!(path && (typeof path === 'string' && !(path instanceof String))))
+            throw `Invalid argument 'path' (expected: string | found: ${typeof(path)})`
+        if(!Buffer.isBuffer(target))
+            throw `Invalid argument 'target' (expected: Buffer | found: ${typeof(target)})`
+        if(!offset)
+            offset = 0;
+        if(!(Number.isInteger(offset) && offset >= 0 && offset <= target.length))
+            throw `Invalid argument 'offset' (expected: integer between 0 and ${target.length} | found: ${offset})`
+        if(!context)
+            context = {};
+        if(!shared)
+            shared = this.frozenShared || {};
+
+        const result = this.binding.renderInto(path, context, {}, shared, bridgeEval, this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone,
+                                               renderTimeout(options), target, offset);
+
+        if(typeof result === 'number')
+            return result;
+
+        const written = target.length - offset;
+
+        if(options && options.overflow) {
+            options.overflow(result);
+            return written;
+        }
+
+        const error = new Error(`Output doesn't fit in the target (${written + result.length} bytes needed, ${written} available)`);
+
+        error.code = 'ERYN_OUTPUT_OVERFLOW';
+        error.needed = written + result.length;
+
+        throw error;
+    }
+
+    // Renders a list of {path, context, shared} items with the same bridge and scratch memory, which is faster than
+    // calling render for each one. Returns a buffer for each item, or with options.concat, a single buffer and the
+    // offsets of the items in it ({ buffer, offsets }). The timeout or deadline is for the whole batch.
+    renderMany(items, options) {
+        if(!Array.isArray(items))
+            throw `Invalid argument 'items' (expected: array | found: ${typeof(items)})`
+
+        const batch = items.map((item, index) => {
+            if(!(item && item.path && typeof item.path === 'string'))
+                throw `Invalid item ${index} (expected: { path: string, context?, shared? })`
+
+            return { path: item.path, context: item.context || {}, shared: item.shared };
+        });
+
+        return this.binding.renderMany(batch, bridgeEval, this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone,
+                                       !!(options && options.concat), renderTimeout(options), this.frozenShared || {},
+                                       !!(options && options.shareStatic));
+    }
+
+    // Renders a manifest of { template, data, output } pages straight to files. The data is a JSON file (optional) that becomes
+    // the context, and the data and output paths are relative to the current directory. The pages are rendered one after the other,
+    // while a native thread reads the data files of the next pages and writes the outputs of the previous ones. Outputs that are
+    // the same as the existing files aren't written, unless options.force is set. Returns { rendered, written, skipped, bytes }.
+    buildSite(manifest, options) {
+        if(!Array.isArray(manifest))
+            throw `Invalid argument 'manifest' (expected: array | found: ${typeof(manifest)})`
+
+        const items = manifest.map((page, index) => {
+            if(!(page && typeof page.template === 'string' && typeof page.output === 'string'))
+                throw `Invalid page ${index} (expected: { template: string, data?: string, output: string })`
+
+            return { path: page.template, data: page.data ? resolve(page.data) : undefined, output: resolve(page.output) };
+        });
+
+        const shared = (options && options.shared) || this.frozenShared || {};
+
+        return this.binding.buildSite(items, shared, bridgeEval, this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone,
+                                      !(options && options.force));
+    }
+
+    renderString(alias, context, shared, options) {
         if(!(alias && (typeof alias === 'string' && !(alias instanceof String))))
             throw `Invalid argument 'alias' (expected: string | found: ${typeof(alias)})`
         if(!context)
             context = {};
         if(!shared)
-            shared = {};
+            shared = this.frozenShared || {};
 
-        return this.binding.renderString(alias, context, {}, shared, bridgeEval, this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone);
+        return this.binding.renderString(alias, context, {}, shared, bridgeEval, this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone, renderTimeout(options),
+                                         !!(options && options.shareStatic));
     }
 
     renderStringUncached(src, context, shared) {
@@ -93,13 +336,21 @@ class ErynBinding {
         if(!context)
             context = {};
         if(!shared)
-            shared = {};
+            shared = this.frozenShared || {};
 
         this.compileString('__ERYN_uncached', src);
 
         return this.binding.renderString('__ERYN_uncached', context, {}, shared, bridgeEval, this.bridgeOptions.enableDeepCloning ? bridgeDeepClone : bridgeShallowClone);
     }
 
+    freezeShared(shared) {
+        if(shared && (typeof shared !== 'object'))
+            throw `Invalid argument 'shared' (expected: object | found: ${typeof(shared)})`
+
+        this.frozenShared = shared ? deepFreeze(shared) : undefined;
+        this.binding.freezeShared(this.frozenShared);
+    }
+
     setOptions(options) {
         if(!(options && (typeof options === 'object')))
             throw `Invalid argument 'options' (expected: object | found: ${typeof(options)})`
@@ -115,4 +366,13 @@ const eryn = (options) => {
     return new ErynBinding(options);
 };
 
+// Statistics of the pool that recycles the memory of rendered outputs (one per thread).
+eryn.outputPoolStats = binding.outputPoolStats;
+
+// Only present in builds configured with ERYN_MEMORY_STATS (remem mapping enabled).
+if(binding.memoryStats) {
+    eryn.memoryStats = binding.memoryStats;
+    eryn.resetMemoryStats = binding.resetMemoryStats;
+}
+
 module.exports = eryn;
@@ -0,0 +1,108 @@
+#include "arena.hxx"
+#include "remem.hxx"
+
+static uintptr_t align_up(uintptr_t value, size_t alignment) {
+    return (value + (alignment - 1)) & ~(static_cast<uintptr_t>(alignment) - 1);
+}
+
+Arena::Arena() : current(nullptr) { }
+
+Arena::~Arena() {
+    release();
+}
+
+void Arena::release() noexcept {
+    while(current != nullptr) {
+        Block* previous = current->previous;
+
+        REMEM_FREE(current);
+        current = previous;
+    }
+}
+
+uint8_t* Arena::block_data(Block* block) const noexcept {
+    return reinterpret_cast<uint8_t*>(block) + align_up(sizeof(Block), alignof(std::max_align_t));
+}
+
+void Arena::add_block(size_t minimum) {
+    size_t capacity = current == nullptr ? ARENA_INITIAL_SIZE : current->capacity * 2;
+
+    while(capacity < minimum) {
+        capacity *= 2;
+    }
+
+    auto block = static_cast<Block*>(REMEM_MALLOC(align_up(sizeof(Block), alignof(std::max_align_t)) + capacity, "Arena"));
+
+    block->previous = current;
+    block->capacity = capacity;
+    block->used     = 0;
+
+    current = block;
+}
+
+void* Arena::alloc(size_t size, size_t alignment) {
+    if(current != nullptr) {
+        auto data  = block_data(current);
+        auto start = align_up(reinterpret_cast<uintptr_t>(data + current->used), alignment) - reinterpret_cast<uintptr_t>(data);
+
+        if(start + size <= current->capacity) {
+            current->used = start + size;
+            return data + start;
+        }
+    }
+
+    // The data of a new block is aligned to max_align_t, so there's no need for padding.
+    add_block(size);
+    current->used = size;
+
+    return block_data(current);
+}
+
+void Arena::free(void* ptr, size_t size) noexcept {
+    if(current == nullptr || ptr == nullptr) {
+        return;
+    }
+
+    auto data = block_data(current);
+
+    if(static_cast<uint8_t*>(ptr) + size == data + current->used) {
+        current->used = static_cast<uint8_t*>(ptr) - data;
+    }
+}
+
+void Arena::reset() {
+    if(current == nullptr) {
+        return;
+    }
+
+    if(current->previous == nullptr) {
+        current->used = 0;
+        return;
+    }
+
+    // Replace all blocks with a single one that can hold everything.
+    size_t total = capacity();
+
+    release();
+    add_block(total);
+}
+
+size_t Arena::used() const noexcept {
+    size_t total = 0;
+
+    for(Block* block = current; block != nullptr; block = block->previous) {
+        total += block->used;
+    }
+
+    return total;
+}
+
+size_t Arena::capacity() const noexcept {
+    size_t total = 0;
+
+    for(Block* block = current; block != nullptr; block = block->previous) {
+        total += block->capacity;
+    }
+
+    return total;
+}
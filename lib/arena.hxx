@@ -0,0 +1,143 @@
+#ifndef ARENA_HXX_GUARD
+#define ARENA_HXX_GUARD
+
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#define ARENA_INITIAL_SIZE 4096u
+
+// A bump pointer allocator. Memory is not freed piece by piece (except for the last allocation),
+// but all at once with reset(). After a reset, the arena keeps a single block as big as all the previous
+// blocks combined, so a workload that repeats itself stops allocating after the first run.
+class Arena {
+    struct Block {
+        Block* previous;
+        size_t capacity;
+        size_t used;
+    };
+
+    Block* current;
+
+    uint8_t* block_data(Block* block) const noexcept;
+    void     add_block(size_t minimum);
+    void     release() noexcept;
+
+    public:
+    Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena();
+
+    void* alloc(size_t size, size_t alignment = alignof(std::max_align_t));
+    // Only the last allocation is actually freed (e.g. the memory of a stack that is popped).
+    void  free(void* ptr, size_t size) noexcept;
+    void  reset();
+
+    size_t used() const noexcept;
+    size_t capacity() const noexcept;
+};
+
+// Lets standard containers (e.g. std::vector) allocate from an arena.
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    Arena* arena;
+
+    ArenaAllocator(Arena& arena) noexcept : arena(&arena) { }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) { }
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(arena->alloc(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, size_t count) noexcept {
+        arena->free(ptr, count * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& left, const ArenaAllocator<U>& right) noexcept {
+    return left.arena == right.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& left, const ArenaAllocator<U>& right) noexcept {
+    return left.arena != right.arena;
+}
+
+// A stack whose items live in an arena. Unlike std::stack, creating an empty one doesn't allocate.
+template <typename T>
+class ArenaStack {
+    Arena* arena;
+    T*     items;
+    size_t count;
+    size_t capacity;
+
+    void grow() {
+        size_t newCapacity = capacity == 0 ? 8 : capacity * 2;
+        T*     newItems    = static_cast<T*>(arena->alloc(newCapacity * sizeof(T), alignof(T)));
+
+        for(size_t i = 0; i < count; ++i) {
+            new(newItems + i) T(std::move(items[i]));
+            items[i].~T();
+        }
+
+        if(items != nullptr) {
+            arena->free(items, capacity * sizeof(T));
+        }
+
+        items    = newItems;
+        capacity = newCapacity;
+    }
+
+    public:
+    ArenaStack(Arena& arena) noexcept : arena(&arena), items(nullptr), count(0), capacity(0) { }
+    ArenaStack(const ArenaStack&) = delete;
+    ArenaStack& operator=(const ArenaStack&) = delete;
+
+    ~ArenaStack() {
+        while(count > 0) {
+            pop();
+        }
+    }
+
+    template <typename... Args>
+    T& emplace(Args&&... args) {
+        if(count == capacity) {
+            grow();
+        }
+
+        return *new(items + count++) T(std::forward<Args>(args)...);
+    }
+
+    void push(const T& item) {
+        emplace(item);
+    }
+
+    void pop() {
+        items[--count].~T();
+    }
+
+    T& top() const {
+        return items[count - 1];
+    }
+
+    T& operator[](size_t index) const {
+        return items[index];
+    }
+
+    bool empty() const noexcept {
+        return count == 0;
+    }
+
+    size_t size() const noexcept {
+        return count;
+    }
+};
+
+#endif
@@ -20,23 +20,33 @@ Buffer::Buffer() : Buffer(nullptr, 0) {
 }
 
 Buffer::Buffer(uint8_t* data, size_t size) :
-    data(data), size(size), capacity(size) { }
+    data(data), size(size), capacity(size), borrowed(false) { }
 
 Buffer::Buffer(const Buffer& buffer) :
-    data(buffer.data), size(buffer.size), capacity(buffer.capacity) { }
+    data(buffer.data), size(buffer.size), capacity(buffer.capacity), borrowed(buffer.borrowed) { }
 
 Buffer::Buffer(Buffer&& buffer) {
     size     = buffer.size;
     capacity = buffer.capacity;
+    borrowed = buffer.borrowed;
     data     = buffer.release();
 }
 
 Buffer::~Buffer() {
-    if(data != nullptr) {
+    if(data != nullptr && !borrowed) {
         REMEM_FREE(data);
     }
 }
 
+Buffer Buffer::borrow(uint8_t* data, size_t capacity) {
+    Buffer buffer(data, 0);
+
+    buffer.capacity = capacity;
+    buffer.borrowed = true;
+
+    return buffer;
+}
+
 uint8_t* Buffer::end() const noexcept {
     return data + size;
 }
@@ -48,6 +58,7 @@ Buffer& Buffer::operator=(const Buffer& buffer) {
         
     size     = buffer.size;
     capacity = buffer.capacity;
+    borrowed = buffer.borrowed;
     data     = buffer.data;
 
     return *this;
@@ -60,6 +71,7 @@ Buffer& Buffer::operator=(Buffer&& buffer) {
 
     size     = buffer.size;
     capacity = buffer.capacity;
+    borrowed = buffer.borrowed;
     data     = buffer.release();
 
     return *this;
@@ -150,13 +162,35 @@ void Buffer::reserve(size_t amount) {
     }
 
     if(data == nullptr) {
-        capacity = BUFFER_INITIAL_SIZE;
-        data = static_cast<uint8_t*>(REMEM_ALLOC(capacity, "Buffer"));
+        capacity = amount > BUFFER_INITIAL_SIZE ? amount : BUFFER_INITIAL_SIZE;
+        data = static_cast<uint8_t*>(REMEM_MALLOC(capacity, "Buffer"));
+        borrowed = false;
+
+        return;
+    }
+
+    if(size + amount <= capacity) {
+        return;
     }
 
-    while(size + amount > capacity) {
-        data = static_cast<uint8_t*>(REMEM_EXPAND(data, capacity));
+    // Find the final capacity first, so that large writes reallocate (and copy) only once.
+    auto target = capacity > 0 ? capacity : BUFFER_INITIAL_SIZE;
+
+    while(size + amount > target) {
+        target *= 2;
     }
+
+    if(borrowed) {
+        auto owned = static_cast<uint8_t*>(REMEM_MALLOC(target, "Buffer"));
+        memcpy(owned, data, size);
+
+        data     = owned;
+        borrowed = false;
+    } else {
+        data = static_cast<uint8_t*>(REMEM_REALLOC(data, target));
+    }
+
+    capacity = target;
 }
 
 uint8_t* Buffer::release() {
@@ -165,12 +199,26 @@ uint8_t* Buffer::release() {
     data = nullptr;
     size = 0;
     capacity = 0;
+    borrowed = false;
 
     return ptr;
 }
 
-ConstBuffer Buffer::finalize() {
-    if(size != capacity) {
+ConstBuffer Buffer::finalize(size_t slack) {
+    // The caller owns the finalized data, so borrowed data is copied (it can't be reallocated or given away).
+    if(borrowed) {
+        auto owned = size > 0 ? static_cast<uint8_t*>(REMEM_MALLOC(size, "Buffer")) : nullptr;
+
+        if(owned != nullptr) {
+            memcpy(owned, data, size);
+        }
+
+        data     = owned;
+        capacity = size;
+        borrowed = false;
+    }
+
+    if(capacity - size > slack) {
         data = (uint8_t*) REMEM_REALLOC(data, size);
     }
 
@@ -12,6 +12,7 @@ struct Buffer {
     uint8_t* data;
     size_t size;
     size_t capacity;
+    bool borrowed; // Whether the data belongs to someone else (see borrow()).
 
     Buffer();
     Buffer(uint8_t* data, size_t size);
@@ -20,6 +21,10 @@ struct Buffer {
 
     ~Buffer();
 
+    // Wraps memory that the buffer doesn't own, and writes to it until it's full. If the buffer needs to grow,
+    // the data is moved to an allocation of its own (and 'borrowed' becomes false).
+    static Buffer borrow(uint8_t* data, size_t capacity);
+
     uint8_t* end() const noexcept;
 
     Buffer& operator=(const Buffer& buffer);
@@ -41,8 +46,9 @@ struct Buffer {
 
     // Returns a pointer to the data and resets the buffer data pointer, along with the size and capacity.
     uint8_t* release();
-    // Creates a ConstBuffer, shrinks the allocated memory for the data buffer if possible, and releases the data pointer.
-    ConstBuffer finalize();
+    // Creates a ConstBuffer, shrinks the allocated memory for the data buffer if more than 'slack' bytes are unused,
+    // and releases the data pointer. Borrowed data is copied to an allocation of its own first.
+    ConstBuffer finalize(size_t slack = 0);
 };
 
 struct ConstBuffer {
@@ -30,7 +30,15 @@
 
 #if defined(REMEM_ENABLE_MAPPING)
     std::unordered_map<void*, re::AddressInfo> map;
+    std::unordered_map<std::string, re::AllocationStats> stats;
     size_t totalSize = 0;
+
+    static void record(const std::string& who, size_t size) {
+        auto& entry = stats[who];
+
+        ++entry.count;
+        entry.bytes += size;
+    }
 #endif
 
 #if !defined(REMEM_EXPAND_FACTOR)
@@ -64,6 +72,7 @@ void* allocateBlock(size_t size, const char* who = nullptr, const char* file = n
     #if defined(REMEM_ENABLE_MAPPING)
         map[ptr] = re::AddressInfo(who == nullptr ? "unknown" : who, size);
         totalSize += size;
+        record(map[ptr].who, size);
 
         #if defined(REMEM_ENABLE_LOGGING)
             if(who == nullptr)
@@ -121,6 +130,14 @@ void operator delete[](void* ptr) noexcept {
     size_t re::mem_size() noexcept {
         return totalSize;
     }
+
+    const std::unordered_map<std::string, re::AllocationStats>& re::mem_stats() noexcept {
+        return stats;
+    }
+
+    void re::mem_stats_reset() noexcept {
+        stats.clear();
+    }
 #endif
 
 void* re::malloc(size_t size, const char* who, const char* file, size_t line) {
@@ -132,6 +149,7 @@ void* re::malloc(size_t size, const char* who, const char* file, size_t line) {
     #if defined(REMEM_ENABLE_MAPPING)
         map[ptr] = re::AddressInfo(who == nullptr ? "unknown" : who, size);
         totalSize += size;
+        record(map[ptr].who, size);
 
         #if defined(REMEM_ENABLE_LOGGING)
             if(who == nullptr)
@@ -160,6 +178,7 @@ void* re::alloc(size_t&  size, const char* who, const char* file, size_t line) {
     #if defined(REMEM_ENABLE_MAPPING)
         map[ptr] = re::AddressInfo(who == nullptr ? "unknown" : who, size);
         totalSize += size;
+        record(map[ptr].who, size);
 
         #if defined(REMEM_ENABLE_LOGGING)
             if(who == nullptr)
@@ -199,6 +218,7 @@ void* re::realloc(void* ptr, size_t size, const char* file, size_t line) {
             totalSize += size;
 
             map[ptr].size = size;
+            record(map[ptr].who, size);
 
             if(ptr != newPtr) {
                 map[newPtr] = map[ptr];
@@ -236,6 +256,7 @@ void* re::expand(void* ptr, size_t& size, const char* file, size_t line) {
             totalSize += size;
 
             map[ptr].size = size;
+            record(map[ptr].who, size);
 
             if(ptr != newPtr) {
                 map[newPtr] = map[ptr];
@@ -52,11 +52,23 @@ namespace re {
         AddressInfo(const char* w, size_t sz) : who(w), size(sz) { }
     };
 
+    // Allocation events recorded for a 'who' tag since the last mem_stats_reset().
+    // Reallocations and expansions count as allocations, with the new block size as bytes.
+    struct AllocationStats {
+        size_t count;
+        size_t bytes;
+
+        AllocationStats() : count(0), bytes(0) { }
+    };
+
     #if defined(REMEM_ENABLE_MAPPING)
         const std::unordered_map<void*, AddressInfo>& mem() noexcept;
 
         void   mem_print() noexcept;
         size_t mem_size()  noexcept;
+
+        const std::unordered_map<std::string, AllocationStats>& mem_stats() noexcept;
+        void mem_stats_reset() noexcept;
     #endif
 
     void* malloc(size_t size, const char* who = nullptr, const char* file = nullptr, size_t line = 0);
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <initializer_list>
 
 #include "bridge.hxx"
@@ -8,38 +9,239 @@ Eryn::BridgeCompileData Eryn::Bridge::to_compile_data() {
     return Eryn::BridgeCompileData(data.env);
 }
 
-bool Eryn::Bridge::call_hook(BridgeCompileData data, BridgeHook& hook, Buffer& input, const char* origin) {
-    auto buff = Napi::Buffer<uint8_t>::New(data.env, (uint8_t*) input.data, input.size);
-    auto originStr = Napi::String::New(data.env, origin);
+Eryn::BridgeShared Eryn::Bridge::get_shared() {
+    return data.shared;
+}
 
-    auto result = hook.Call(std::initializer_list<napi_value>({ buff, originStr }));
+void Eryn::Bridge::reset(BridgeBackup context, BridgeShared shared) {
+    data.context = context;
+    data.local   = Napi::Object::New(data.env);
+    data.shared  = shared;
+}
 
-    if (result.IsString()) {
-        LOG_DEBUG("Hook result is string");
+Eryn::BridgeBackup Eryn::Bridge::parse_json(BridgeCompileData data, ConstBuffer json) {
+    if (json.size == 0) {
+        return Napi::Object::New(data.env);
+    }
 
-        auto str = result.As<Napi::String>().Utf8Value();
-        auto ptr = reinterpret_cast<const uint8_t*>(str.c_str());
+    auto JSON  = data.env.Global().Get("JSON").As<Napi::Object>();
+    auto parse = JSON.Get("parse").As<Napi::Function>();
 
-        input.clear();
-        input.write(ptr, str.size());
+    return parse.Call(JSON, { Napi::String::New(data.env, reinterpret_cast<const char*>(json.data), json.size) });
+}
+
+// Nested objects deeper than this (or cycles) aren't serialized.
+static constexpr size_t SERIALIZE_MAX_DEPTH = 16;
+
+static void serialize_length(Buffer& output, size_t length) {
+    auto value = static_cast<uint32_t>(length);
+    output.write(reinterpret_cast<const uint8_t*>(&value), sizeof(value));
+}
+
+// Every value starts with its type, and strings, arrays and objects with their length, so different values can't
+// have the same bytes. Only plain objects are serialized, since class instances can render differently (e.g. getters).
+static bool serialize_value(Eryn::BridgeCompileData data, const Napi::Value& value, Buffer& output, size_t limit, size_t depth,
+                            Napi::Value& objectPrototype) {
+    if (output.size > limit || depth > SERIALIZE_MAX_DEPTH) {
+        return false;
+    }
+
+    switch (value.Type()) {
+        case napi_undefined:
+            output.write(reinterpret_cast<const uint8_t*>("u"), 1);
+            return true;
+        case napi_null:
+            output.write(reinterpret_cast<const uint8_t*>("n"), 1);
+            return true;
+        case napi_boolean:
+            output.write(reinterpret_cast<const uint8_t*>(value.ToBoolean().Value() ? "t" : "f"), 1);
+            return true;
+        case napi_number: {
+            auto number = value.As<Napi::Number>().DoubleValue();
+
+            output.write(reinterpret_cast<const uint8_t*>("d"), 1);
+            output.write(reinterpret_cast<const uint8_t*>(&number), sizeof(number));
+            return true;
+        }
+        case napi_string: {
+            output.write(reinterpret_cast<const uint8_t*>("s"), 1);
+
+            auto start = output.size;
+            serialize_length(output, 0);
+
+            Eryn::Bridge::write_string(data, value.As<Napi::String>(), output);
+
+            auto length = static_cast<uint32_t>(output.size - start - sizeof(uint32_t));
+            memcpy(output.data + start, &length, sizeof(length));
+            return true;
+        }
+        case napi_object:
+            break;
+        default:
+            return false;
+    }
+
+    if (value.IsArray()) {
+        auto array  = value.As<Napi::Array>();
+        auto length = array.Length();
+
+        output.write(reinterpret_cast<const uint8_t*>("a"), 1);
+        serialize_length(output, length);
+
+        for (uint32_t i = 0; i < length; ++i) {
+            if (!serialize_value(data, array.Get(i), output, limit, depth + 1, objectPrototype)) {
+                return false;
+            }
+        }
 
         return true;
-    } else if (result.IsBuffer()) {
+    }
+
+    if (value.IsBuffer()) {
+        return false;
+    }
+
+    napi_value prototype;
+
+    if (napi_get_prototype(data.env, value, &prototype) != napi_ok) {
+        return false;
+    }
+
+    if (objectPrototype.IsEmpty()) {
+        objectPrototype = data.env.Global().Get("Object").As<Napi::Object>().Get("prototype");
+    }
+
+    if (!objectPrototype.StrictEquals(Napi::Value(data.env, prototype))) {
+        return false;
+    }
+
+    auto object = value.As<Napi::Object>();
+    auto keys   = object.GetPropertyNames();
+    auto length = keys.Length();
+
+    output.write(reinterpret_cast<const uint8_t*>("o"), 1);
+    serialize_length(output, length);
+
+    for (uint32_t i = 0; i < length; ++i) {
+        auto key = keys.Get(i);
+
+        if (!serialize_value(data, key, output, limit, depth + 1, objectPrototype) ||
+            !serialize_value(data, object.Get(key), output, limit, depth + 1, objectPrototype)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Eryn::Bridge::serialize_context(Buffer& output, size_t limit) {
+    Napi::Value objectPrototype;
+
+    try {
+        return serialize_value(to_compile_data(), data.context, output, limit, 0, objectPrototype) && output.size <= limit;
+    } catch (std::exception&) {
+        return false; // Getters that throw, proxies, etc.
+    }
+}
+
+void Eryn::Bridge::stash(BridgeStash& stash) {
+    stash(data.eval);
+    stash(data.clone);
+    stash(data.context);
+    stash(data.local);
+    stash(data.shared);
+}
+
+void Eryn::Bridge::write_string(BridgeCompileData data, const Napi::String& str, Buffer& output) {
+    size_t length;
+
+    if (napi_get_value_string_utf8(data.env, str, nullptr, 0, &length) != napi_ok) {
+        throw Napi::Error::New(data.env, "Cannot read string");
+    }
+
+    // N-API always writes the null terminator, which is then overwritten by the next write.
+    output.reserve(length + 1);
+
+    if (napi_get_value_string_utf8(data.env, str, reinterpret_cast<char*>(output.end()), length + 1, &length) != napi_ok) {
+        throw Napi::Error::New(data.env, "Cannot read string");
+    }
+
+    output.size += length;
+}
+
+static Eryn::HookResult to_hook_result(Napi::Value value) {
+    Eryn::HookResult result;
+
+    if (value.IsString()) {
+        LOG_DEBUG("Hook result is string");
+
+        result.replace = true;
+        result.content = value.As<Napi::String>().Utf8Value();
+    } else if (value.IsBuffer()) {
         LOG_DEBUG("Hook result is buffer");
 
-        auto ptr    = reinterpret_cast<uint8_t*>(result.As<Napi::Buffer<char>>().Data());
-        auto length = result.As<Napi::Buffer<char>>().Length();
+        auto ptr    = value.As<Napi::Buffer<char>>().Data();
+        auto length = value.As<Napi::Buffer<char>>().Length();
+
+        result.replace = true;
+        result.content.assign(ptr, length);
+    } else if (!value.IsUndefined() && !value.IsNull()) {
+        LOG_DEBUG("Hook result is invalid");
+
+        result.valid = false;
+    } else {
+        LOG_DEBUG("Hook result is undefined or null");
+    }
+
+    return result;
+}
+
+bool Eryn::Bridge::call_hook(BridgeCompileData data, BridgeHook& hook, Buffer& input, const char* origin) {
+    auto buff = Napi::Buffer<uint8_t>::New(data.env, (uint8_t*) input.data, input.size);
+    auto originStr = Napi::String::New(data.env, origin);
+
+    auto result = to_hook_result(hook.Call(std::initializer_list<napi_value>({ buff, originStr })));
+
+    if (!result.valid) {
+        return false;
+    }
 
+    if (result.replace) {
         input.clear();
-        input.write(ptr, length);
+        input.write(reinterpret_cast<const uint8_t*>(result.content.c_str()), result.content.size());
+    }
 
-        return true;
-    } else if (!result.IsUndefined() && !result.IsNull()) {
-        LOG_DEBUG("Hook result is invalid");
+    return true;
+}
+
+bool Eryn::Bridge::call_batch_hook(BridgeCompileData data, BridgeHook& hook, const std::vector<const HookSegment*>& segments, std::vector<HookResult>& results) {
+    auto array = Napi::Array::New(data.env, segments.size());
+
+    for (uint32_t i = 0; i < segments.size(); ++i) {
+        auto& content = segments[i]->content;
+        auto  segment = Napi::Object::New(data.env);
+
+        segment.Set("content", Napi::Buffer<char>::Copy(data.env, content.c_str(), content.size()));
+        segment.Set("origin", Napi::String::New(data.env, segments[i]->origin));
+
+        array.Set(i, segment);
+    }
+
+    auto value = hook.Call(std::initializer_list<napi_value>({ array }));
+
+    if (!value.IsArray() || value.As<Napi::Array>().Length() != segments.size()) {
+        LOG_DEBUG("Batch hook result is not an array with one result for each segment");
         return false;
     }
 
-    LOG_DEBUG("Hook result is undefined or null");
+    auto resultArray = value.As<Napi::Array>();
+
+    results.clear();
+    results.reserve(segments.size());
+
+    for (uint32_t i = 0; i < segments.size(); ++i) {
+        results.push_back(to_hook_result(resultArray.Get(i)));
+    }
 
     return true;
-}
\ No newline at end of file
+}
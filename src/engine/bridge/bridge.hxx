@@ -4,19 +4,45 @@
 #include "napi.h"
 #include <node_api.h>
 
+#include <string>
+#include <vector>
 #include <variant>
 
 #include "../../def/warnings.dxx"
 #include "../../../lib/buffer.hxx"
+#include "../../../lib/arena.hxx"
 
 namespace Eryn {
 typedef Napi::FunctionReference  BridgeHook;
 typedef Napi::Buffer<uint8_t>    BridgeHookResult;
 typedef Napi::Value              BridgeBackup;
+typedef Napi::Value              BridgeShared;
 typedef Napi::Array              BridgeArray;
 typedef Napi::Object             BridgeObject;
 typedef Napi::Object             BridgeIterable;
-typedef std::vector<Napi::Value> BridgeObjectKeys;
+typedef std::vector<Napi::Value, ArenaAllocator<Napi::Value>> BridgeObjectKeys; // Allocated in the render arena.
+
+// A part of a template that is passed to the compile hook.
+struct HookSegment {
+    std::string content;
+    const char* origin;
+
+    HookSegment(const uint8_t* data, size_t size, const char* origin) : origin(origin) {
+        if (size > 0) {
+            content.assign(reinterpret_cast<const char*>(data), size);
+        }
+    }
+};
+
+// What the compile hook returned for a segment.
+struct HookResult {
+    bool        valid;   // False if the result is not a Buffer, String, Null or Undefined.
+    bool        replace; // False if the result is Null or Undefined, in which case the segment stays as it is.
+    std::string content;
+
+    HookResult() : valid(true), replace(false) {
+    }
+};
 
 // Contains data necessary for the bridge, such as the context and local objects.
 // Also includes references to needed functions such as eval.
@@ -38,6 +64,28 @@ struct BridgeRenderData {
     }
 };
 
+// JS values can't be kept in native memory between calls (their handles belong to the scope of the call).
+// So, when a render continues in a later call, the values are moved to an array that is kept alive with a reference,
+// and moved back (in the same order) when the render continues.
+class BridgeStash {
+    Napi::Array array;
+    uint32_t    index;
+    bool        restoring;
+
+    public:
+    BridgeStash(Napi::Array array, bool restoring) : array(array), index(0), restoring(restoring) {
+    }
+
+    template <typename T>
+    void operator()(T& value) {
+        if (restoring) {
+            value = array.Get(index++).As<T>();
+        } else {
+            array.Set(index++, value);
+        }
+    }
+};
+
 struct BridgeCompileData {
     public:
     Napi::Env env;
@@ -58,12 +106,29 @@ class Bridge {
     // Currently, the renderer holds BridgeRenderData, and has to pass the Napi::Env to the compiler.
     // So, use this function for that.
     BridgeCompileData to_compile_data();
+    BridgeShared      get_shared();
+    // Points the bridge at new render data, with an empty local object (for batches, which render many items with one bridge).
+    void              reset(BridgeBackup context, BridgeShared shared);
+    void              stash(BridgeStash& stash);
+    // Writes the context as bytes that are equal only for equal contexts (used as a memoization key). Returns false
+    // if the context can't be compared this way (e.g. it has functions or class instances), or if it's larger than 'limit'.
+    bool              serialize_context(Buffer& output, size_t limit);
 
     // The buffer passed to the hook, and will be overwritten with the hook result
     // (only if the result is a Buffer or String)
     // Origin - where the hook was called from (normal template, conditional template, component path, component context, etc)
     static bool call_hook(BridgeCompileData data, BridgeHook& hook, Buffer& input, const char* origin);
 
+    // Calls the hook once, with an array of { content, origin } objects (one for each segment).
+    // The hook should return an array with one result for each segment. Returns false if it doesn't.
+    static bool call_batch_hook(BridgeCompileData data, BridgeHook& hook, const std::vector<const HookSegment*>& segments, std::vector<HookResult>& results);
+
+    // Writes a string as UTF-8 directly to the output, without a temporary std::string.
+    static void write_string(BridgeCompileData data, const Napi::String& str, Buffer& output);
+
+    // Parses the JSON to a context value (an empty input is an empty object).
+    static BridgeBackup parse_json(BridgeCompileData data, ConstBuffer json);
+
 // Declare all bridge methods as pure virtual.
 // See the bridge_methods.dxx file for the declarations.
 #define BRIDGE_METHOD(decl) virtual decl = 0
@@ -75,6 +140,11 @@ class NormalBridge : public Bridge {
     public:
     NormalBridge(BridgeRenderData&& data);
 
+    // Evaluate scripts that don't depend on the render data (e.g. literals) when compiling. If the shared object
+    // is frozen, the scripts can also read it. These return false if the script can't be evaluated, so it's left for the renderer.
+    static bool eval_constant_template(BridgeCompileData data, ConstBuffer input, Buffer& output, BridgeShared shared = BridgeShared());
+    static bool eval_constant_conditional(BridgeCompileData data, ConstBuffer input, bool& output, BridgeShared shared = BridgeShared());
+
 // Declare all bridge methods with override.
 #define BRIDGE_METHOD(decl) decl override
 #include "bridge_methods.dxx"
@@ -24,17 +24,17 @@ static Napi::Value call_eval(Eryn::BridgeRenderData& data, const Napi::String& s
 }
 
 static Napi::Value call_eval(Eryn::BridgeRenderData& data, ConstBuffer script) {
-    std::string str = std::string(reinterpret_cast<const char*>(script.data), script.size);
-    
     // If the user writes {test: "Test"}, this should be treated as an expression.
     // By default, it's treated as a block, but it will be treated as an expression if it's
     // surrounded by parentheses. If the user truly wants the script to start with a block,
     // they have to place dummy content like /**/ or /* Block */ before the opening bracket.
     if(script.size > 0 && script.data[0] == '{') {
-        str ="(" + str + ")";
+        std::string str = std::string(reinterpret_cast<const char*>(script.data), script.size);
+
+        return call_eval(data, Napi::String::New(data.env, "(" + str + ")"));
     }
 
-    return call_eval(data, Napi::String::New(data.env, str));
+    return call_eval(data, Napi::String::New(data.env, reinterpret_cast<const char*>(script.data), script.size));
 }
 
 static Napi::Value call_clone(Eryn::BridgeRenderData& data, const Napi::Value& original) {
@@ -43,28 +43,14 @@ static Napi::Value call_clone(Eryn::BridgeRenderData& data, const Napi::Value& o
     }));
 }
 
-Eryn::NormalBridge::NormalBridge(Eryn::BridgeRenderData&& data) : Bridge(std::forward<Eryn::BridgeRenderData>(data)) { }
-
-void Eryn::NormalBridge::evalTemplate(ConstBuffer input, Buffer& output) {
-    Napi::Value result;
-
-    try {
-        result = call_eval(data, input);
-    } catch(Eryn::RenderingException& e) {
-        throw e;
-    } catch(std::exception &e) {
-        throw Eryn::RenderingException("Template error", e.what(), input);
-    }
-
+// Writes the result of a template to the output. Returns false if the result type is not supported.
+static bool write_result(const Napi::Env& env, const Napi::Value& result, Buffer& output) {
     if(result.IsUndefined() || result.IsNull()) {
-        return;
+        return true;
     } else if(result.IsString()) {
         LOG_DEBUG("    Type: string");
 
-        auto str = result.As<Napi::String>().Utf8Value();
-        auto ptr = reinterpret_cast<const uint8_t*>(str.c_str());
-
-        output.write(ptr, str.size());
+        Eryn::Bridge::write_string(Eryn::BridgeCompileData(env), result.As<Napi::String>(), output);
     } else if(result.IsBuffer()) {
         LOG_DEBUG("    Type: buffer");
 
@@ -75,14 +61,14 @@ void Eryn::NormalBridge::evalTemplate(ConstBuffer input, Buffer& output) {
     } else if(result.IsObject()) {
         LOG_DEBUG("    Type: object");
 
-        auto str = stringify(data.env, result.As<Napi::Object>());
+        auto str = stringify(env, result.As<Napi::Object>());
         auto ptr = reinterpret_cast<const uint8_t*>(str.c_str());
 
         output.write(ptr, str.size());
     } else if(result.IsArray()) {
         LOG_DEBUG("    Type: array");
 
-        auto str = stringify(data.env, result.ToObject());
+        auto str = stringify(env, result.ToObject());
         auto ptr = reinterpret_cast<const uint8_t*>(str.c_str());
 
         output.write(ptr, str.size());
@@ -104,6 +90,72 @@ void Eryn::NormalBridge::evalTemplate(ConstBuffer input, Buffer& output) {
             output.write(reinterpret_cast<const uint8_t*>("false"), sizeof("false") - 1);
         }
     } else {
+        return false;
+    }
+
+    return true;
+}
+
+// Evaluates a script in the global scope, without any render data. Used for constant scripts.
+// If the shared object is not empty, the script is evaluated in a function that receives it.
+static bool call_global_eval(const Napi::Env& env, ConstBuffer script, const Eryn::BridgeShared& shared, Napi::Value& result) {
+    std::string str = std::string(reinterpret_cast<const char*>(script.data), script.size);
+
+    try {
+        auto eval = env.Global().Get("eval").As<Napi::Function>();
+
+        if(shared.IsEmpty()) {
+            result = eval.Call(std::initializer_list<napi_value>({ Napi::String::New(env, str) }));
+        } else {
+            auto fn = eval.Call(std::initializer_list<napi_value>({ Napi::String::New(env, "(function(shared) { return (\n" + str + "\n); })") }));
+
+            result = fn.As<Napi::Function>().Call(std::initializer_list<napi_value>({ shared }));
+        }
+    } catch(std::exception& e) {
+        UNREFERENCED(e); // The exception data is used in debug mode. Suppress release warnings.
+
+        LOG_DEBUG("Constant script error: %s", e.what());
+        return false;
+    }
+
+    return true;
+}
+
+Eryn::NormalBridge::NormalBridge(Eryn::BridgeRenderData&& data) : Bridge(std::forward<Eryn::BridgeRenderData>(data)) { }
+
+bool Eryn::NormalBridge::eval_constant_template(BridgeCompileData data, ConstBuffer input, Buffer& output, BridgeShared shared) {
+    Napi::Value result;
+
+    if(!call_global_eval(data.env, input, shared, result)) {
+        return false;
+    }
+
+    return write_result(data.env, result, output);
+}
+
+bool Eryn::NormalBridge::eval_constant_conditional(BridgeCompileData data, ConstBuffer input, bool& output, BridgeShared shared) {
+    Napi::Value result;
+
+    if(!call_global_eval(data.env, input, shared, result)) {
+        return false;
+    }
+
+    output = result.ToBoolean().Value();
+    return true;
+}
+
+void Eryn::NormalBridge::evalTemplate(ConstBuffer input, Buffer& output) {
+    Napi::Value result;
+
+    try {
+        result = call_eval(data, input);
+    } catch(Eryn::RenderingException& e) {
+        throw e;
+    } catch(std::exception &e) {
+        throw Eryn::RenderingException("Template error", e.what(), input);
+    }
+
+    if(!write_result(data.env, result, output)) {
         throw Eryn::RenderingException("Unsupported template return type", "must be string, number, boolean, Object, Array, Buffer, null or undefined", input);
     }
 }
@@ -132,18 +184,20 @@ bool Eryn::NormalBridge::evalConditionalTemplate(ConstBuffer input) {
     return result.ToBoolean().Value();
 }
 
-void Eryn::NormalBridge::evalIteratorArrayAssignment(bool cloneIterators, const std::string& iterator, const BridgeIterable& iterable, uint32_t index) {
+void Eryn::NormalBridge::evalIteratorArrayAssignment(bool cloneIterators, ConstBuffer iterator, const BridgeIterable& iterable, uint32_t index) {
+    auto key = Napi::String::New(data.env, reinterpret_cast<const char*>(iterator.data), iterator.size);
+
     if(cloneIterators) {
-        data.local[iterator] = call_clone(
+        data.local.Set(key, call_clone(
             data,
             iterable.Get(index)
-        );
+        ));
     } else {
-        data.local[iterator] = iterable.Get(index);
+        data.local.Set(key, iterable.Get(index));
     }
 }
 
-void Eryn::NormalBridge::evalIteratorObjectAssignment(bool cloneIterators, const std::string& iterator, const Eryn::BridgeIterable& iterable, const Eryn::BridgeObjectKeys& keys, uint32_t index) {
+void Eryn::NormalBridge::evalIteratorObjectAssignment(bool cloneIterators, ConstBuffer iterator, const Eryn::BridgeIterable& iterable, const Eryn::BridgeObjectKeys& keys, uint32_t index) {
     auto it = Napi::Object::New(data.env);
 
     it["key"] = keys[index];
@@ -157,7 +211,7 @@ void Eryn::NormalBridge::evalIteratorObjectAssignment(bool cloneIterators, const
         it["value"] = iterable.Get(keys[index]);
     }
 
-    data.local[iterator] = it;
+    data.local.Set(Napi::String::New(data.env, reinterpret_cast<const char*>(iterator.data), iterator.size), it);
 }
 
 bool Eryn::NormalBridge::initLoopIterable(ConstBuffer arrayScript, Eryn::BridgeIterable& iterable, Eryn::BridgeObjectKeys& keys) {
@@ -201,11 +255,8 @@ bool Eryn::NormalBridge::initLoopIterable(ConstBuffer arrayScript, Eryn::BridgeI
     return isSimpleArray;
 }
 
-void Eryn::NormalBridge::unassign(const std::string &iterator) {
-    data.local[iterator] = call_eval(
-        data,
-        Napi::String::New(data.env, "undefined")
-    );
+void Eryn::NormalBridge::unassign(ConstBuffer iterator) {
+    data.local.Set(Napi::String::New(data.env, reinterpret_cast<const char*>(iterator.data), iterator.size), data.env.Undefined());
 }
 
 // Like call_clone, but this one is exposed by the bridge and also catches any exceptions.
@@ -114,10 +114,7 @@ void Eryn::StrictBridge::evalTemplate(ConstBuffer input, Buffer& output) {
     } else if(result.IsString()) {
         LOG_DEBUG("    Type: string");
 
-        auto str = result.As<Napi::String>().Utf8Value();
-        auto ptr = reinterpret_cast<const uint8_t*>(str.c_str());
-
-        output.write(ptr, str.size());
+        Eryn::Bridge::write_string(Eryn::BridgeCompileData(data.env), result.As<Napi::String>(), output);
     } else if(result.IsBuffer()) {
         LOG_DEBUG("    Type: buffer");
 
@@ -179,18 +176,20 @@ bool Eryn::StrictBridge::evalConditionalTemplate(ConstBuffer input) {
     return result.ToBoolean().Value();
 }
 
-void Eryn::StrictBridge::evalIteratorArrayAssignment(bool cloneIterators, const std::string& iterator, const BridgeIterable& iterable, uint32_t index) {
+void Eryn::StrictBridge::evalIteratorArrayAssignment(bool cloneIterators, ConstBuffer iterator, const BridgeIterable& iterable, uint32_t index) {
+    auto key = Napi::String::New(data.env, reinterpret_cast<const char*>(iterator.data), iterator.size);
+
     if(cloneIterators) {
-        data.local[iterator] = call_clone(
+        data.local.Set(key, call_clone(
             data,
             iterable.Get(index)
-        );
+        ));
     } else {
-        data.local[iterator] = iterable.Get(index);
+        data.local.Set(key, iterable.Get(index));
     }
 }
 
-void Eryn::StrictBridge::evalIteratorObjectAssignment(bool cloneIterators, const std::string& iterator, const Eryn::BridgeIterable& iterable, const Eryn::BridgeObjectKeys& keys, uint32_t index) {
+void Eryn::StrictBridge::evalIteratorObjectAssignment(bool cloneIterators, ConstBuffer iterator, const Eryn::BridgeIterable& iterable, const Eryn::BridgeObjectKeys& keys, uint32_t index) {
     auto it = Napi::Object::New(data.env);
 
     it["key"] = keys[index];
@@ -204,7 +203,7 @@ void Eryn::StrictBridge::evalIteratorObjectAssignment(bool cloneIterators, const
         it["value"] = iterable.Get(keys[index]);
     }
 
-    data.local[iterator] = it;
+    data.local.Set(Napi::String::New(data.env, reinterpret_cast<const char*>(iterator.data), iterator.size), it);
 }
 
 bool Eryn::StrictBridge::initLoopIterable(ConstBuffer arrayScript, Eryn::BridgeIterable& iterable, Eryn::BridgeObjectKeys& keys) {
@@ -248,7 +247,7 @@ bool Eryn::StrictBridge::initLoopIterable(ConstBuffer arrayScript, Eryn::BridgeI
     return isSimpleArray;
 }
 
-void Eryn::StrictBridge::unassign(const std::string &iterator) {
+void Eryn::StrictBridge::unassign(ConstBuffer iterator) {
     
 }
 
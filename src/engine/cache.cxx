@@ -1,18 +1,69 @@
 #include "engine.hxx"
 
-Eryn::Cache::~Cache() {
-    for(auto& entry : entries) {
-        ConstBuffer::finalize(entry.second);
+#include "../def/osh.dxx"
+
+static const BDP::Header BDP832 = BDP::Header(8, 32);
+
+static void free_osh(const uint8_t* osh) {
+    ConstBuffer buffer(osh, 0);
+    ConstBuffer::finalize(buffer);
+}
+
+// The compiler outputs a single plaintext pair for templates without holes (SVG icons, footers, etc).
+static bool find_static_text(const ConstBuffer& osh, ConstBuffer& text) {
+    size_t index = 0;
+    size_t nameLength;
+    size_t valueLength;
+
+    if(osh.size < BDP832.NAME_LENGTH_BYTE_SIZE + OSH_PLAINTEXT_LENGTH + BDP832.VALUE_LENGTH_BYTE_SIZE) {
+        return false;
+    }
+
+    BDP::bytesToLength(nameLength, osh.data, BDP832.NAME_LENGTH_BYTE_SIZE);
+    index += BDP832.NAME_LENGTH_BYTE_SIZE;
+
+    if(nameLength != OSH_PLAINTEXT_LENGTH || osh.data[index] != *OSH_PLAINTEXT) {
+        return false;
     }
+
+    index += nameLength;
+
+    BDP::bytesToLength(valueLength, osh.data + index, BDP832.VALUE_LENGTH_BYTE_SIZE);
+    index += BDP832.VALUE_LENGTH_BYTE_SIZE;
+
+    if(index + valueLength != osh.size) {
+        return false;
+    }
+
+    text = ConstBuffer(osh.data + index, valueLength);
+    return true;
 }
 
 void Eryn::Cache::add(const string& key, ConstBuffer&& value) {
-    if(has(key)) {
-        ConstBuffer::finalize(get(key));
+    // If the key exists, the old OSH is freed here (unless it's shared).
+    auto& entry = entries[key];
+
+    entry.osh         = value;
+    entry.owner       = std::shared_ptr<const uint8_t>(value.data, free_osh);
+    entry.isStatic    = find_static_text(value, entry.text);
+    entry.purityKnown = entry.isStatic;
+    entry.isPure      = entry.isStatic;
+}
+
+void Eryn::Cache::remove(const string& key) {
+    if(!has(key)) {
+        return;
     }
 
-    // TODO: test if the move constructor is called.
-    entries[key] = value;
+    entries.erase(key);
+    outputSizes.erase(key);
+    untrack(key);
+}
+
+void Eryn::Cache::clear() {
+    entries.clear();
+    dependencies.clear();
+    outputSizes.clear();
 }
 
 ConstBuffer& Eryn::Cache::get(const string& key) {
@@ -20,9 +71,82 @@ ConstBuffer& Eryn::Cache::get(const string& key) {
         throw ERYN_INTERNAL_EXCEPTION(("Cache item '" + key) + "' not found; get() must be guarded by has()");
     }
 
-    return entries[key];
+    return entries[key].osh;
+}
+
+bool Eryn::Cache::get_static(const string& key, ConstBuffer& text) const {
+    auto entry = entries.find(key);
+
+    if(entry == entries.end() || !entry->second.isStatic) {
+        return false;
+    }
+
+    text = entry->second.text;
+    return true;
+}
+
+bool Eryn::Cache::is_pure(const string& key) {
+    auto entry = entries.find(key);
+
+    if(entry == entries.end()) {
+        return false;
+    }
+
+    if(!entry->second.purityKnown) {
+        entry->second.isPure      = is_side_effect_free(entry->second.osh);
+        entry->second.purityKnown = true;
+    }
+
+    return entry->second.isPure;
+}
+
+std::shared_ptr<const uint8_t> Eryn::Cache::share(const string& key) {
+    if(!has(key)) {
+        throw ERYN_INTERNAL_EXCEPTION(("Cache item '" + key) + "' not found; share() must be guarded by has()");
+    }
+
+    return entries[key].owner;
 }
 
 bool Eryn::Cache::has(const string& key) const {
     return entries.find(key) != entries.end();
-}
\ No newline at end of file
+}
+
+void Eryn::Cache::track(const string& key, const string& dependency) {
+    dependencies[key].insert(dependency);
+}
+
+void Eryn::Cache::untrack(const string& key) {
+    dependencies.erase(key);
+}
+
+std::vector<string> Eryn::Cache::dependents(const string& dependency) const {
+    std::vector<string> result;
+
+    for(const auto& entry : dependencies) {
+        if(entry.second.find(dependency) != entry.second.end()) {
+            result.push_back(entry.first);
+        }
+    }
+
+    return result;
+}
+
+size_t Eryn::Cache::output_size(const string& key) const {
+    auto size = outputSizes.find(key);
+
+    return size != outputSizes.end() ? size->second : 0;
+}
+
+// Jumps to any larger size right away, but only decays by 1/8 towards smaller ones. This keeps the estimate
+// near the upper end of the recent sizes (like a high percentile), so that most renders fit in one allocation,
+// while a single unusually large render is forgotten after a few smaller ones.
+void Eryn::Cache::record_output_size(const string& key, size_t size) {
+    auto& estimate = outputSizes[key];
+
+    if(size >= estimate) {
+        estimate = size;
+    } else {
+        estimate -= (estimate - size) / 8;
+    }
+}
@@ -4,9 +4,11 @@
 #include <cstdio>
 #include <cstdint>
 #include <cstdlib>
+#include <cctype>
+#include <cstring>
 #include <cstddef>
 #include <cstdint>
-#include <unordered_set>
+#include <algorithm>
 
 #include "engine.hxx"
 
@@ -28,11 +30,28 @@
     #include <dirent.h>
 #endif
 
+using Eryn::InternalException;
+
 static constexpr auto COMPILER_PATH_SEPARATOR   = '/';
 static constexpr auto COMPILER_ERROR_CHUNK_SIZE = 40u;
 static constexpr auto COMPILER_PATH_MAX_LENGTH  = 4096u;
 
-static void localize_iterator(const ConstBuffer& iterator, Buffer& src);
+// The names of the iterators of all loops that are currently open, stored in a perfect hash table.
+// The table is rebuilt whenever a loop starts or ends, which is rare compared to the lookups.
+struct IteratorSet {
+    std::vector<ConstBuffer> slots; // Empty slots have a null data pointer.
+    uint32_t seed;
+    size_t   mask;
+
+    IteratorSet() : seed(0), mask(0) { }
+
+    void build(const std::vector<ConstBuffer>& iterators);
+    bool contains(const uint8_t* name, size_t size) const;
+
+    static uint32_t hash(const uint8_t* data, size_t size, uint32_t seed);
+};
+
+static void localize_iterators(const IteratorSet& iteratorSet, Buffer& src);
 
 enum class TemplateType {
     CONDITIONAL,
@@ -52,6 +71,20 @@ struct TemplateStackInfo {
         type(typ), outputBodyIndex(body), inputIndex(input), outputIndex(output) { };
 };
 
+// The templates that are recognized right after the template start, in the order in which they are matched.
+// Markers can share a prefix (e.g. the else conditional and the else), so the order matters.
+enum StartMarker : uint8_t {
+    START_COMMENT,
+    START_CONDITIONAL,
+    START_ELSE_CONDITIONAL,
+    START_ELSE,
+    START_LOOP,
+    START_COMPONENT,
+    START_VOID,
+    START_BODY_END,
+    START_MARKER_COUNT
+};
+
 struct TemplateEndInfo {
     std::vector<const uint8_t*> escapes;
     size_t index;
@@ -75,11 +108,39 @@ struct Compiler {
 
     std::stack<TemplateStackInfo> templates;
     std::vector<ConstBuffer>      iterators;
+    IteratorSet                   iteratorSet;
+
+    // For each byte, a bitmask of the start markers that begin with it (see StartMarker).
+    uint8_t dispatch[256];
+
+    // How the compile hook is called. When batchCompileHook is set, the input is compiled twice: the first pass
+    // only collects the segments, and the second one applies the results of the batch, in the same order.
+    // Segments that are not the same in the second pass (e.g. a result changed how the rest of the file is parsed)
+    // are sent to the hook on their own, so the output is the same as with the direct hook.
+    enum class HookMode {
+        DIRECT,
+        COLLECT,
+        APPLY
+    } hookMode;
+
+    std::vector<Eryn::HookSegment>* hookSegments; // Where the segments are collected (and compared with, when applying).
+    std::vector<Eryn::HookResult>*  hookResults;  // Where the results are applied from.
+    size_t                          hookIndex;
+    Eryn::HookMemo*                 hookMemo;     // Null if memoizeCompileHook is not set.
+
+    // The state of the HTML minifier is kept between plaintext runs (e.g. a <pre> that contains templates).
+    struct {
+        const char* rawEnd;  // The closing tag of the current raw element (pre, textarea, script, style).
+        bool        comment; // Whether a comment that is kept (e.g. it contains templates) is open.
+        bool        tag;     // Whether the run is inside a tag, where attribute values are kept as they are.
+        uint8_t     quote;   // The quote of the attribute value that is open (0 if none).
+    } minifier;
 
     const BDP::Header BDP832 = BDP::Header(8, 32);
 
     Compiler(Eryn::Options* opts, Eryn::BridgeCompileData bridge, ConstBuffer input, const char* wd, const char* path)
-        : opts(opts), bridge(bridge), input(input), wd(wd), path(path), start(input.data), current(start) { }
+        : opts(opts), bridge(bridge), input(input), wd(wd), path(path), start(input.data), current(start),
+          hookMode(HookMode::DIRECT), hookSegments(nullptr), hookResults(nullptr), hookIndex(0), hookMemo(nullptr), minifier{ nullptr, false, false, 0 } { }
 
     void rebase(size_t index);
     void rebase(const uint8_t* ptr);
@@ -89,11 +150,16 @@ struct Compiler {
     void skip_whitespace();
     void skip_whitespace_back();
     bool match_current(const std::string& pattern);
+    bool has_hook() const;
+
+    void   build_dispatch(const std::string* (&markers)[START_MARKER_COUNT]);
+    int    match_start_marker(const std::string* (&markers)[START_MARKER_COUNT]);
 
     TemplateEndInfo find_template_end(const uint8_t* from);
     TemplateEndInfo find_comment_template_end(const uint8_t* from);
 
     void write_escaped_content(Buffer& buffer, const uint8_t* start, const uint8_t* end, const std::vector<const uint8_t*>& escapes);
+    void write_minified_html(Buffer& buffer, const uint8_t* start, const uint8_t* end);
     void localize_all_iterators(Buffer& src);
     void error(const char* file, const char* message, const char* description, size_t errorIndex);
 
@@ -157,6 +223,38 @@ bool Compiler::match_current(const std::string& pattern) {
     return input.match(current - input.data, pattern);
 }
 
+void Compiler::build_dispatch(const std::string* (&markers)[START_MARKER_COUNT]) {
+    memset(dispatch, 0, sizeof(dispatch));
+
+    // An empty marker never matches, so it doesn't go in the table.
+    for(int i = 0; i < START_MARKER_COUNT; ++i) {
+        if(!markers[i]->empty()) {
+            dispatch[static_cast<uint8_t>((*markers[i])[0])] |= static_cast<uint8_t>(1u << i);
+        }
+    }
+}
+
+// Returns the first start marker (in StartMarker order) that matches at the current position, or -1.
+int Compiler::match_start_marker(const std::string* (&markers)[START_MARKER_COUNT]) {
+    if(current >= input.end()) {
+        return -1;
+    }
+
+    uint8_t candidates = dispatch[*current];
+
+    for(int i = 0; candidates != 0; ++i, candidates >>= 1) {
+        if((candidates & 1u) && match_current(*markers[i])) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool Compiler::has_hook() const {
+    return opts->compilePlugin || !opts->compileHook.IsEmpty();
+}
+
 void Compiler::prepare_template_start(const char* name, size_t markerSize) {
     LOG_DEBUG("Detected %s template", name)
 
@@ -185,21 +283,205 @@ void Compiler::compile_plaintext() {
     }
 
     if(!skip) {
-        if (!opts->compileHook.IsEmpty()) {
-            Buffer buffer;
+        // The plaintext that is written (the hook result, if there's a hook).
+        const uint8_t* textStart = start;
+        const uint8_t* textEnd   = current;
+
+        Buffer buffer;
+
+        if (has_hook()) {
             buffer.write(start, current - start);
 
             call_hook(buffer, "plaintext");
+
+            textStart = buffer.data;
+            textEnd   = buffer.data + buffer.size;
+
+            if(textStart == textEnd) {
+                LOG_DEBUG("Skipping plaintext removed by the hook");
+                return;
+            }
+        }
+
+        if(opts->flags.minifyHTML) {
+            Buffer minified;
+            write_minified_html(minified, textStart, textEnd);
+
+            if(minified.size == 0) {
+                LOG_DEBUG("Skipping minified plaintext");
+                return;
+            }
+
+            LOG_DEBUG("Writing minified plaintext as BDP832 pair %zu -> %zu...", start - input.data, current - input.data);
+            output.write_bdp_pair(BDP832, OSH_PLAINTEXT_MARKER, OSH_PLAINTEXT_LENGTH, minified.data, minified.size);
+            LOG_DEBUG("done\n");
+
+            return;
         }
 
         LOG_DEBUG("Writing plaintext as BDP832 pair %zu -> %zu...", start - input.data, current - input.data);
-        output.write_bdp_pair(BDP832, OSH_PLAINTEXT_MARKER, OSH_PLAINTEXT_LENGTH, start, current - start);
+        output.write_bdp_pair(BDP832, OSH_PLAINTEXT_MARKER, OSH_PLAINTEXT_LENGTH, textStart, textEnd - textStart);
         LOG_DEBUG("done\n");
     } else {
         LOG_DEBUG("Skipping blank plaintext");
     }
 }
 
+// Finds a pattern, ignoring the case.
+static const uint8_t* find_ignore_case(const uint8_t* start, const uint8_t* end, const char* pattern) {
+    size_t length = strlen(pattern);
+
+    for(; start + length <= end; ++start) {
+        size_t i = 0;
+
+        while(i < length && std::tolower(start[i]) == pattern[i]) {
+            ++i;
+        }
+
+        if(i == length) {
+            return start;
+        }
+    }
+
+    return nullptr;
+}
+
+// Collapses whitespace runs to a single character (a newline if the run contains one, a space otherwise), and removes
+// HTML comments. Raw elements (pre, textarea, script, style), quoted attribute values and comments that are not closed
+// in this run are kept as they are.
+void Compiler::write_minified_html(Buffer& buffer, const uint8_t* start, const uint8_t* end) {
+    static const char* const rawStarts[] = { "<pre", "<textarea", "<script", "<style" };
+    static const char* const rawEnds[]   = { "</pre", "</textarea", "</script", "</style" };
+
+    const uint8_t* i = start;
+
+    while(i < end) {
+        if(minifier.rawEnd != nullptr || minifier.comment) {
+            const char*    pattern = minifier.comment ? "-->" : minifier.rawEnd;
+            const uint8_t* found   = find_ignore_case(i, end, pattern);
+
+            if(found == nullptr) {
+                buffer.write(i, end - i);
+                return;
+            }
+
+            found += strlen(pattern);
+            buffer.write(i, found - i);
+            i = found;
+
+            minifier.rawEnd  = nullptr;
+            minifier.comment = false;
+            continue;
+        }
+
+        if(minifier.quote != 0) {
+            const uint8_t* found = static_cast<const uint8_t*>(memchr(i, minifier.quote, end - i));
+
+            // The value continues after a template (e.g. title="[|name|]  ").
+            if(found == nullptr) {
+                buffer.write(i, end - i);
+                return;
+            }
+
+            buffer.write(i, (found + 1) - i);
+            i = found + 1;
+
+            minifier.quote = 0;
+            continue;
+        }
+
+        if(minifier.tag && (*i == '"' || *i == '\'')) {
+            minifier.quote = *i;
+            buffer.write(*i);
+            ++i;
+            continue;
+        }
+
+        if(minifier.tag && *i == '>') {
+            minifier.tag = false;
+            buffer.write(*i);
+            ++i;
+            continue;
+        }
+
+        if(str::is_blank(*i)) {
+            bool newline = false;
+
+            while(i < end && str::is_blank(*i)) {
+                newline = newline || (*i == '\n');
+                ++i;
+            }
+
+            // There may be whitespace before a removed comment.
+            if(buffer.size > 0 && str::is_blank(buffer.data[buffer.size - 1])) {
+                if(newline) {
+                    buffer.data[buffer.size - 1] = '\n';
+                }
+            } else {
+                buffer.write(newline ? '\n' : ' ');
+            }
+
+            continue;
+        }
+
+        if(*i != '<') {
+            buffer.write(*i);
+            ++i;
+            continue;
+        }
+
+        if(end - i >= 4 && mem::cmp(i, "<!--", 4)) {
+            const uint8_t* found = find_ignore_case(i + 4, end, "-->");
+
+            // Comments such as <!--[if IE]> and <!--! License --> are kept.
+            bool keep = (end - i > 4) && (i[4] == '[' || i[4] == '!');
+
+            if(found == nullptr) {
+                // Written as it is in the next iteration.
+                minifier.comment = true;
+                continue;
+            }
+
+            if(keep) {
+                buffer.write(i, (found + 3) - i);
+            }
+
+            i = found + 3;
+            continue;
+        }
+
+        bool raw = false;
+
+        for(size_t j = 0; j < sizeof(rawStarts) / sizeof(rawStarts[0]); ++j) {
+            size_t length = strlen(rawStarts[j]);
+
+            if(i + length > end || find_ignore_case(i, i + length, rawStarts[j]) == nullptr) {
+                continue;
+            }
+
+            // Make sure that the tag name ends here (e.g. <pre> and not <prefix>).
+            if(i + length < end && !str::is_blank(i[length]) && i[length] != '>' && i[length] != '/') {
+                continue;
+            }
+
+            buffer.write(i, length);
+            i += length;
+
+            minifier.rawEnd = rawEnds[j];
+            raw = true;
+            break;
+        }
+
+        if(!raw) {
+            // A tag starts with a letter (or '/' and '!', for closing tags and doctypes), so 'a < b' is still text.
+            minifier.tag = (end - i > 1) && (std::isalpha(i[1]) || i[1] == '/' || i[1] == '!');
+
+            buffer.write(*i);
+            ++i;
+        }
+    }
+}
+
 void Compiler::compile_comment() {
     rebase(current);
 
@@ -212,7 +494,7 @@ void Compiler::compile_comment() {
 
     LOG_DEBUG("Found template end at %zu", templateEndIndex);
 
-    if (!opts->compileHook.IsEmpty()) {
+    if (has_hook()) {
         Buffer buffer;
         buffer.write(start, templateEndIndex - (start - input.data));
 
@@ -249,7 +531,7 @@ void Compiler::compile_conditional() {
     write_escaped_content(buffer, start, current, endInfo.escapes);
     localize_all_iterators(buffer);
 
-    if (!opts->compileHook.IsEmpty()) {
+    if (has_hook()) {
         call_hook(buffer, "conditional");
     }
 
@@ -297,7 +579,7 @@ void Compiler::compile_else_conditional() {
     write_escaped_content(buffer, start, current, endInfo.escapes);
     localize_all_iterators(buffer);
 
-    if (!opts->compileHook.IsEmpty()) {
+    if (has_hook()) {
         call_hook(buffer, "else_conditional");
     }
 
@@ -420,7 +702,7 @@ void Compiler::compile_loop() {
     Buffer iterableBuffer;
     ConstBuffer finalIterableBuffer(leftStart, leftLength);
 
-    if (!opts->compileHook.IsEmpty()) {
+    if (has_hook()) {
         iterableBuffer.write(leftStart, leftEnd - leftStart);
 
         call_hook(iterableBuffer, "loop_iterator");
@@ -434,7 +716,7 @@ void Compiler::compile_loop() {
     write_escaped_content(buffer, rightStart, current, endInfo.escapes);
     localize_all_iterators(buffer);
 
-    if (!opts->compileHook.IsEmpty()) {
+    if (has_hook()) {
         call_hook(buffer, "loop_iterable");
     }
 
@@ -464,6 +746,7 @@ void Compiler::compile_loop() {
         
     templates.push(TemplateStackInfo(TemplateType::LOOP, output.size, start - input.data, oshStart));
     iterators.push_back(ConstBuffer(leftStart, leftLength));
+    iteratorSet.build(iterators);
 
     LOG_DEBUG("done\n");
 
@@ -572,7 +855,7 @@ void Compiler::compile_component() {
     Buffer pathBuffer;
     ConstBuffer finalPathBuffer(leftStart, leftEnd - leftStart);
 
-    if (!opts->compileHook.IsEmpty()) {
+    if (has_hook()) {
         pathBuffer.write(leftStart, leftEnd - leftStart);
 
         call_hook(pathBuffer, "component_path");
@@ -588,7 +871,7 @@ void Compiler::compile_component() {
         write_escaped_content(buffer, rightStart, rightEnd, endInfo.escapes);
         localize_all_iterators(buffer);
 
-        if (!opts->compileHook.IsEmpty()) {
+        if (has_hook()) {
             call_hook(buffer, "component_context");
         }
     }
@@ -645,7 +928,7 @@ void Compiler::compile_void() {
     write_escaped_content(buffer, start, current, endInfo.escapes);
     localize_all_iterators(buffer);
 
-    if (!opts->compileHook.IsEmpty()) {
+    if (has_hook()) {
         call_hook(buffer, "void");
     }
 
@@ -753,6 +1036,7 @@ void Compiler::compile_body_end() {
             output.write_length(output.size + OSH_FORMAT - templates.top().outputBodyIndex, OSH_FORMAT);
 
             iterators.pop_back();
+            iteratorSet.build(iterators);
             break;
         case TemplateType::COMPONENT:
             output.write_length(templates.top().outputBodyIndex, backup - templates.top().outputBodyIndex - OSH_FORMAT, OSH_FORMAT);
@@ -788,7 +1072,7 @@ void Compiler::compile_normal() {
         write_escaped_content(buffer, start, current, endInfo.escapes);
         localize_all_iterators(buffer);
 
-        if (!opts->compileHook.IsEmpty()) {
+        if (has_hook()) {
             call_hook(buffer, "template");
         }
 
@@ -803,30 +1087,232 @@ void Compiler::compile_normal() {
     advance(opts->templates.end.size());
 }
 
+static std::string hook_memo_key(const char* origin, const uint8_t* data, size_t size) {
+    std::string key(origin);
+
+    key += '\0';
+    key.append(reinterpret_cast<const char*>(data), size);
+
+    return key;
+}
+
+static bool resolve_hook_batch(Eryn::BridgeCompileData bridge, Eryn::BridgeHook& hook, Eryn::HookMemo* memo,
+                               const std::vector<Eryn::HookSegment>& segments, std::vector<Eryn::HookResult>& results);
+
+static bool is_same_segment(const Eryn::HookSegment& segment, const Buffer& buffer, const char* origin) {
+    return strcmp(segment.origin, origin) == 0 && segment.content.size() == buffer.size &&
+           (buffer.size == 0 || mem::cmp(segment.content.data(), buffer.data, buffer.size));
+}
+
 void Compiler::call_hook(Buffer& buffer, const char* origin) {
-    LOG_DEBUG("Running hook");
-    if (!Eryn::Bridge::call_hook(bridge, opts->compileHook, buffer, origin)) {
-        error(path, "Hook returned invalid value", "the compile hook should return Buffer, String, Null or Undefined", start - input.data);
+    if(hookMode == HookMode::COLLECT) {
+        hookSegments->emplace_back(buffer.data, buffer.size, origin);
+        return;
+    }
+
+    if(hookMode == HookMode::APPLY) {
+        std::vector<Eryn::HookResult> resolved;
+
+        const Eryn::HookResult* found = nullptr;
+
+        if(hookIndex < hookSegments->size() && is_same_segment((*hookSegments)[hookIndex], buffer, origin)) {
+            found = &(*hookResults)[hookIndex];
+        } else {
+            LOG_DEBUG("Segment differs from the collecting pass, running hook for it");
+
+            std::vector<Eryn::HookSegment> single;
+            single.emplace_back(buffer.data, buffer.size, origin);
+
+            if(!resolve_hook_batch(bridge, opts->compileHook, hookMemo, single, resolved) || resolved.size() != 1) {
+                error(path, "Hook returned invalid value", "the batch compile hook should return an array with one result for each segment", start - input.data);
+            }
+
+            found = &resolved[0];
+        }
+
+        ++hookIndex;
+
+        auto& result = *found;
+
+        if(!result.valid) {
+            error(path, "Hook returned invalid value", "the compile hook should return Buffer, String, Null or Undefined", start - input.data);
+        }
+
+        if(result.replace) {
+            buffer.clear();
+            buffer.write(reinterpret_cast<const uint8_t*>(result.content.c_str()), result.content.size());
+        }
+
+        return;
+    }
+
+    std::string key;
+
+    if(hookMemo != nullptr) {
+        key = hook_memo_key(origin, buffer.data, buffer.size);
+
+        auto entry = hookMemo->find(key);
+
+        if(entry != hookMemo->end()) {
+            LOG_DEBUG("Using memoized hook result");
+
+            buffer.clear();
+            buffer.write(reinterpret_cast<const uint8_t*>(entry->second.c_str()), entry->second.size());
+
+            return;
+        }
+    }
+
+    if(opts->compilePlugin) {
+        LOG_DEBUG("Running hook plugin");
+
+        if(!opts->compilePlugin->call(buffer, origin)) {
+            error(path, "Hook returned invalid value", "the plugin transform should return ERYN_TRANSFORM_KEEP or ERYN_TRANSFORM_REPLACE", start - input.data);
+        }
+    } else {
+        LOG_DEBUG("Running hook");
+
+        if (!Eryn::Bridge::call_hook(bridge, opts->compileHook, buffer, origin)) {
+            error(path, "Hook returned invalid value", "the compile hook should return Buffer, String, Null or Undefined", start - input.data);
+        }
+    }
+
+    if(hookMemo != nullptr) {
+        (*hookMemo)[key] = std::string(reinterpret_cast<const char*>(buffer.data), buffer.size);
     }
 }
 
+// Gets the results for all segments of a file. The ones that are not memoized are sent to the hook in a single call.
+static bool resolve_hook_batch(Eryn::BridgeCompileData bridge, Eryn::BridgeHook& hook, Eryn::HookMemo* memo,
+                               const std::vector<Eryn::HookSegment>& segments, std::vector<Eryn::HookResult>& results) {
+    results.assign(segments.size(), Eryn::HookResult());
+
+    std::vector<std::string> keys;
+    std::vector<size_t>      sources(segments.size(), SIZE_MAX); // The segment which has the same key (if any), when memoizing.
+
+    std::vector<const Eryn::HookSegment*> pending;
+    std::vector<size_t>                   pendingIndices;
+
+    if(memo != nullptr) {
+        std::unordered_map<std::string, size_t> firstIndices;
+
+        keys.reserve(segments.size());
+
+        for(size_t i = 0; i < segments.size(); ++i) {
+            keys.push_back(hook_memo_key(segments[i].origin, reinterpret_cast<const uint8_t*>(segments[i].content.c_str()), segments[i].content.size()));
+
+            auto entry = memo->find(keys[i]);
+
+            if(entry != memo->end()) {
+                results[i].replace = true;
+                results[i].content = entry->second;
+
+                continue;
+            }
+
+            auto first = firstIndices.find(keys[i]);
+
+            if(first != firstIndices.end()) {
+                sources[i] = first->second;
+                continue;
+            }
+
+            firstIndices[keys[i]] = i;
+        }
+    }
+
+    for(size_t i = 0; i < segments.size(); ++i) {
+        if(sources[i] == SIZE_MAX && (memo == nullptr || !results[i].replace)) {
+            pending.push_back(&segments[i]);
+            pendingIndices.push_back(i);
+        }
+    }
+
+    LOG_DEBUG("Running batch hook with %zu of %zu segments", pending.size(), segments.size());
+
+    if(!pending.empty()) {
+        std::vector<Eryn::HookResult> batch;
+
+        if(!Eryn::Bridge::call_batch_hook(bridge, hook, pending, batch)) {
+            return false;
+        }
+
+        for(size_t j = 0; j < batch.size(); ++j) {
+            size_t index = pendingIndices[j];
+
+            results[index] = std::move(batch[j]);
+
+            if(memo != nullptr && results[index].valid) {
+                (*memo)[keys[index]] = results[index].replace ? results[index].content : segments[index].content;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < segments.size(); ++i) {
+        if(sources[i] != SIZE_MAX) {
+            results[i] = results[sources[i]];
+        }
+    }
+
+    return true;
+}
+
 void Eryn::Engine::compile(BridgeCompileData bridge, const char* path) {
     LOG_DEBUG("===> Compiling file '%s'", path);
 
-    cache.add(path, std::move(compile_file(bridge, path)));
+    ConstBuffer osh;
+
+    compiling.insert(path);
+
+    try {
+        osh = optimize(bridge, compile_file(bridge, path), path, true);
+    } catch(...) {
+        compiling.erase(path);
+        throw;
+    }
+
+    compiling.erase(path);
+    cache.add(path, std::move(osh));
+    specialized.remove(path);
 
     LOG_DEBUG("===> Done\n");
+
+    compile_dependents(bridge, path);
 }
 
 void Eryn::Engine::compile_string(BridgeCompileData bridge, const char* alias, const char* str) {
     LOG_DEBUG("===> Compiling string '%s'", alias);
 
     ConstBuffer input(str, strlen(str));
-    cache.add(alias, compile_bytes(bridge, input, "", alias));
+    cache.add(alias, optimize(bridge, compile_bytes(bridge, input, "", alias), alias, false));
+    specialized.remove(alias);
 
     LOG_DEBUG("===> Done\n");
 }
 
+bool Eryn::Engine::is_compiling(const string& path) const {
+    return compiling.find(path) != compiling.end();
+}
+
+// Compiles the files that were built using this file (e.g. they inlined it), so they don't use stale OSH.
+void Eryn::Engine::compile_dependents(BridgeCompileData bridge, const char* path) {
+    for(const auto& dependent : cache.dependents(path)) {
+        if(is_compiling(dependent)) {
+            continue;
+        }
+
+        LOG_DEBUG("===> Recompiling dependent '%s'", dependent.c_str());
+
+        try {
+            compile(bridge, dependent.c_str());
+        } catch(CompilationException& e) {
+            // The dependent can't be compiled anymore (e.g. it was deleted), so don't keep the stale OSH around.
+            LOG_ERROR("Error: %s", e.what());
+            cache.remove(dependent);
+        }
+    }
+}
+
 void Eryn::Engine::compile_dir(BridgeCompileData bridge, const char* path, std::vector<string> filters) {
     LOG_DEBUG("===> Compiling directory '%s'", path);
 
@@ -978,10 +1464,24 @@ ConstBuffer Eryn::Engine::compile_file(BridgeCompileData bridge, const char* pat
     return compile_bytes(bridge, inputBuffer, wd.c_str(), path);
 }
 
-// 'wd' is the working directory, which is necessary to find components
-// 'path' is either the full path of the source file, or the alias of the source string
-ConstBuffer Eryn::Engine::compile_bytes(BridgeCompileData bridge, ConstBuffer& input, const char* wd, const char* path) {
-    Compiler compiler(&opts, bridge, input, wd, path);
+// Runs a compiler over its whole input.
+static ConstBuffer compile_input(Compiler& compiler) {
+    Eryn::Options& opts  = *compiler.opts;
+    ConstBuffer&   input = compiler.input;
+    const char*    path  = compiler.path;
+
+    const std::string* markers[START_MARKER_COUNT] = {
+        &opts.templates.commentStart,
+        &opts.templates.conditionalStart,
+        &opts.templates.elseConditionalStart,
+        &opts.templates.elseStart,
+        &opts.templates.loopStart,
+        &opts.templates.componentStart,
+        &opts.templates.voidStart,
+        &opts.templates.bodyEnd
+    };
+
+    compiler.build_dispatch(markers);
 
     compiler.rebase((size_t) 0);
     compiler.seek(input.find(opts.templates.start));
@@ -997,33 +1497,43 @@ ConstBuffer Eryn::Engine::compile_bytes(BridgeCompileData bridge, ConstBuffer& i
         compiler.advance(opts.templates.start.size());
         compiler.skip_whitespace(); // Skips whitespace such that, for example, both [|? |] and [| ? |] work.
 
-        if(compiler.match_current(compiler.opts->templates.commentStart)) {
-            compiler.prepare_template_start("comment", opts.templates.commentStart.size());
-            compiler.compile_comment();
-        } else if(compiler.match_current(opts.templates.conditionalStart)) {
-            compiler.prepare_template_start("conditional", opts.templates.conditionalStart.size());
-            compiler.compile_conditional();
-        } else if(compiler.match_current(opts.templates.elseConditionalStart)) {
-            compiler.prepare_template_start("else conditional", opts.templates.elseConditionalStart.size());
-            compiler.compile_else_conditional();
-        } else if(compiler.match_current(opts.templates.elseStart)) {
-            compiler.prepare_template_start("else", opts.templates.elseStart.size());
-            compiler.compile_else();
-        } else if(compiler.match_current(opts.templates.loopStart)) {
-            compiler.prepare_template_start("loop", opts.templates.loopStart.size());
-            compiler.compile_loop();
-        } else if(compiler.match_current(opts.templates.componentStart)) {
-            compiler.prepare_template_start("component", opts.templates.componentStart.size());
-            compiler.compile_component();
-        } else if(compiler.match_current(opts.templates.voidStart)) {
-            compiler.prepare_template_start("void", opts.templates.voidStart.size());
-            compiler.compile_void();
-        } else if(compiler.match_current(opts.templates.bodyEnd)) {
-            compiler.prepare_template_start("body end", opts.templates.bodyEnd.size());
-            compiler.compile_body_end();
-        } else { // Normal Template.
-            compiler.prepare_template_start("normal", 0);
-            compiler.compile_normal();
+        switch(compiler.match_start_marker(markers)) {
+            case START_COMMENT:
+                compiler.prepare_template_start("comment", opts.templates.commentStart.size());
+                compiler.compile_comment();
+                break;
+            case START_CONDITIONAL:
+                compiler.prepare_template_start("conditional", opts.templates.conditionalStart.size());
+                compiler.compile_conditional();
+                break;
+            case START_ELSE_CONDITIONAL:
+                compiler.prepare_template_start("else conditional", opts.templates.elseConditionalStart.size());
+                compiler.compile_else_conditional();
+                break;
+            case START_ELSE:
+                compiler.prepare_template_start("else", opts.templates.elseStart.size());
+                compiler.compile_else();
+                break;
+            case START_LOOP:
+                compiler.prepare_template_start("loop", opts.templates.loopStart.size());
+                compiler.compile_loop();
+                break;
+            case START_COMPONENT:
+                compiler.prepare_template_start("component", opts.templates.componentStart.size());
+                compiler.compile_component();
+                break;
+            case START_VOID:
+                compiler.prepare_template_start("void", opts.templates.voidStart.size());
+                compiler.compile_void();
+                break;
+            case START_BODY_END:
+                compiler.prepare_template_start("body end", opts.templates.bodyEnd.size());
+                compiler.compile_body_end();
+                break;
+            default: // Normal Template.
+                compiler.prepare_template_start("normal", 0);
+                compiler.compile_normal();
+                break;
         }
 
         compiler.rebase(compiler.current);
@@ -1064,6 +1574,48 @@ ConstBuffer Eryn::Engine::compile_bytes(BridgeCompileData bridge, ConstBuffer& i
     return compiler.output.finalize();
 }
 
+// 'wd' is the working directory, which is necessary to find components
+// 'path' is either the full path of the source file, or the alias of the source string
+ConstBuffer Eryn::Engine::compile_bytes(BridgeCompileData bridge, ConstBuffer& input, const char* wd, const char* path) {
+    HookMemo* memo = opts.flags.memoizeCompileHook ? &hookMemo : nullptr;
+
+    // Plugins are cheap to call, so they are never batched.
+    if(opts.compileHook.IsEmpty() || opts.compilePlugin || !opts.flags.batchCompileHook) {
+        Compiler compiler(&opts, bridge, input, wd, path);
+        compiler.hookMemo = memo;
+
+        return compile_input(compiler);
+    }
+
+    std::vector<HookSegment> segments;
+    std::vector<HookResult>  results;
+
+    {
+        LOG_DEBUG("Collecting hook segments");
+
+        Compiler collector(&opts, bridge, input, wd, path);
+
+        collector.hookMode     = Compiler::HookMode::COLLECT;
+        collector.hookSegments = &segments;
+
+        ConstBuffer discarded = compile_input(collector);
+        ConstBuffer::finalize(discarded);
+    }
+
+    if(!resolve_hook_batch(bridge, opts.compileHook, memo, segments, results)) {
+        throw CompilationException(path, "Hook returned invalid value", "the batch compile hook should return an array with one result for each segment");
+    }
+
+    Compiler compiler(&opts, bridge, input, wd, path);
+
+    compiler.hookMode     = Compiler::HookMode::APPLY;
+    compiler.hookSegments = &segments;
+    compiler.hookResults  = &results;
+    compiler.hookMemo     = memo;
+
+    return compile_input(compiler);
+}
+
 void Compiler::localize_all_iterators(Buffer& src) {
     if(iterators.empty()) {
         return;
@@ -1071,17 +1623,7 @@ void Compiler::localize_all_iterators(Buffer& src) {
     
     LOG_DEBUG("Localizing iterators");
 
-    // If 2 or more iterators share the same name, don't replace twice.
-    std::unordered_set<std::string> iteratorSet;
-
-    for(const auto& iterator : iterators) {
-        std::string iteratorString = std::string(reinterpret_cast<const char*>(iterator.data), iterator.size);
-
-        if(iteratorSet.find(iteratorString) == iteratorSet.end()) {
-            iteratorSet.insert(iteratorString);
-            localize_iterator(iterator, src);
-        }
-    }
+    localize_iterators(iteratorSet, src);
 }
 
 void Compiler::error(const char* file, const char* message, const char* description, size_t errorIndex) {
@@ -1128,14 +1670,76 @@ void Compiler::write_escaped_content(Buffer& buffer, const uint8_t* start, const
     buffer.write(start, end - start);
 }
 
-static void localize_iterator(const ConstBuffer& iterator, Buffer& src) {
-    size_t index = 0;
-    size_t matchIndex = 0;
+uint32_t IteratorSet::hash(const uint8_t* data, size_t size, uint32_t seed) {
+    uint32_t result = 2166136261u ^ (seed * 0x9E3779B9u);
+
+    for(size_t i = 0; i < size; ++i) {
+        result = (result ^ data[i]) * 16777619u;
+    }
+
+    return result ^ (result >> 15);
+}
+
+void IteratorSet::build(const std::vector<ConstBuffer>& iterators) {
+    size_t capacity = 4;
+
+    while(capacity < iterators.size() * 2) {
+        capacity *= 2;
+    }
+
+    // Look for a seed that doesn't cause collisions. If there isn't one, try again with a bigger table.
+    while(true) {
+        for(seed = 1; seed <= 16; ++seed) {
+            slots.assign(capacity, ConstBuffer(nullptr, 0));
+            mask = capacity - 1;
+
+            bool perfect = true;
+
+            for(const auto& iterator : iterators) {
+                auto& slot = slots[hash(iterator.data, iterator.size, seed) & mask];
+
+                if(slot.data == nullptr) {
+                    slot = iterator;
+                } else if(slot.size != iterator.size || !mem::cmp(slot.data, iterator.data, slot.size)) {
+                    perfect = false;
+                    break;
+                } // Else, 2 iterators share the same name.
+            }
+
+            if(perfect) {
+                return;
+            }
+        }
+
+        capacity *= 2;
+    }
+}
+
+bool IteratorSet::contains(const uint8_t* name, size_t size) const {
+    if(slots.empty()) {
+        return false;
+    }
+
+    const auto& slot = slots[hash(name, size, seed) & mask];
+
+    return slot.data != nullptr && slot.size == size && mem::cmp(slot.data, name, size);
+}
+
+// Rewrites every iterator in the expression as a local (e.g. 'item' becomes 'local["item"]') in a single pass.
+// Iterators inside strings, properties (e.g. 'obj.item') and object keys (e.g. '{item: item}') are left as they are.
+static void localize_iterators(const IteratorSet& iteratorSet, Buffer& src) {
+    Buffer result;
+    size_t written = 0; // Everything before this index was already written to the result.
+    size_t index   = 0;
 
     uint8_t quoteCount         = 0;
     uint8_t quoteTemplateCount = 0; // Template count, for template literals such as `text ${template}`.
     uint8_t quoteType          = 0;
 
+    auto is_template_literal_start = [&](size_t i) {
+        return src.data[i] == '$' && i < src.size - 1 && src.data[i + 1] == '{' && quoteCount > 0 && quoteType == '`';
+    };
+
     while(index < src.size) {
         uint8_t ch = src.data[index];
 
@@ -1143,99 +1747,79 @@ static void localize_iterator(const ConstBuffer& iterator, Buffer& src) {
             case '\'':
             case '\"':
             case  '`':
-                if(index > 0 && src.data[index - 1] == '\\') {
-                    ++index;
-                    matchIndex = index; // Quotes. The iterator won't be matched, so reset the index.
+                if(index == 0 || src.data[index - 1] != '\\') {
+                    if(quoteCount == 0) {
+                        ++quoteCount;
+                        quoteType = ch;
+                    } else if(quoteType == ch) {
+                        --quoteCount;
+                    }
+                }
+
+                ++index;
+                continue;
+            case '$':
+                if(is_template_literal_start(index)) {
+                    --quoteCount;
+                    ++quoteTemplateCount;
 
+                    index += 2;
                     continue;
                 }
 
-                if(quoteCount == 0) {
+                break;
+            case '}':
+                if(quoteTemplateCount > 0) {
+                    --quoteTemplateCount;
                     ++quoteCount;
-                    quoteType = ch;
-                } else if(quoteType == ch) {
-                    --quoteCount;
+                    quoteType = '`';
                 }
 
                 ++index;
-                matchIndex = index;
-
                 continue;
+        }
 
-            case '$': // Template literals.
-            case '}':
-                if(ch == '$') { // Doing the check again so both characters can branch, and also fall to default if needed.
-                    if(index < src.size - 1 && src.data[index + 1] == '{') {
-                        if(quoteCount > 0 && quoteType == '`') {
-                            --quoteCount;
-                            ++quoteTemplateCount;
-
-                            index += 2;
-                            matchIndex = index;
-
-                            continue;
-                        }
-                    }
-                } else {
-                    if(quoteTemplateCount > 0) {
-                        --quoteTemplateCount;
-                        ++quoteCount;
-                        quoteType = '`';
-
-                        ++index;
-                        matchIndex = index;
-
-                        continue;
-                    }
-                }
-            
-            default: { // Regular characters fall here.
-                if(index > 0 && matchIndex == index) {
-                    if(src.data[index - 1] == '.'
-                    || src.data[index - 1] == '\\'
-                    || str::valid_in_token(src.data[index - 1])) {
+        if(!str::valid_in_token(ch)) {
+            ++index;
+            continue;
+        }
 
-                        ++index;
-                        matchIndex = index;
+        size_t tokenStart = index;
 
-                        continue;
-                    }
-                }
+        do {
+            ++index;
+        } while(index < src.size && str::valid_in_token(src.data[index]) && !is_template_literal_start(index));
 
-                if(ch == iterator.data[index - matchIndex] && (quoteCount == 0 || quoteCount < quoteTemplateCount)) {
-                    if(index - matchIndex + 1 == iterator.size) {
-                        if(index < src.size - 1
-                        && (str::valid_in_token(src.data[index + 1])
-                        ||  src.data[index + 1] == ':')) { // For object properties, such as {item: item}.
+        size_t tokenSize = index - tokenStart;
 
-                            ++index;
-                            matchIndex = index;
+        if(quoteCount > 0 && quoteCount >= quoteTemplateCount) {
+            continue;
+        }
+        if(tokenStart > 0 && (src.data[tokenStart - 1] == '.' || src.data[tokenStart - 1] == '\\')) {
+            continue;
+        }
+        if(index < src.size && (str::valid_in_token(src.data[index]) || src.data[index] == ':')) { // For object properties, such as {item: item}.
+            continue;
+        }
+        if(!iteratorSet.contains(src.data + tokenStart, tokenSize)) {
+            continue;
+        }
 
-                            continue;
-                        }
+        result.write(src.data + written, tokenStart - written);
+        result.write(OSH_TEMPLATE_LOCAL_PREFIX, OSH_TEMPLATE_LOCAL_PREFIX_LENGTH);
+        result.write(src.data + tokenStart, tokenSize);
+        result.write(OSH_TEMPLATE_LOCAL_SUFFIX, OSH_TEMPLATE_LOCAL_SUFFIX_LENGTH);
 
-                        // Copy the prefix.
-                        src.move_right(matchIndex, OSH_TEMPLATE_LOCAL_PREFIX_LENGTH);
-                        src.write_at(matchIndex, OSH_TEMPLATE_LOCAL_PREFIX, OSH_TEMPLATE_LOCAL_PREFIX_LENGTH);
+        written = index;
+    }
 
-                        matchIndex += OSH_TEMPLATE_LOCAL_PREFIX_LENGTH + iterator.size;
+    // Nothing was localized, so the source stays as it is.
+    if(written == 0) {
+        return;
+    }
 
-                        // Copy the suffix.
-                        src.move_right(matchIndex, OSH_TEMPLATE_LOCAL_SUFFIX_LENGTH);
-                        src.write_at(matchIndex, OSH_TEMPLATE_LOCAL_SUFFIX, OSH_TEMPLATE_LOCAL_SUFFIX_LENGTH);
-                        
-                        index = matchIndex + OSH_TEMPLATE_LOCAL_SUFFIX_LENGTH;
-                        matchIndex = index;
+    result.write(src.data + written, src.size - written);
 
-                        continue;
-                    } else {
-                        ++index;
-                    }
-                } else {
-                    ++index;
-                    matchIndex = index;
-                }
-            }
-        }
-    }
-}
\ No newline at end of file
+    src.clear();
+    src.write(result.data, result.size);
+}
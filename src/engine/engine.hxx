@@ -4,6 +4,11 @@
 #include <exception>
 #include <memory>
 #include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <deque>
 
 #include "../def/warnings.dxx"
 #include "../../lib/chunk.hxx"
@@ -15,6 +20,8 @@
 
 #include "bridge/bridge.hxx"
 
+#include "../../include/eryn_plugin.h"
+
 using std::string;
 
 #define ERYN_INTERNAL_EXCEPTION(msg) (InternalException(msg, __FILE__, __LINE__))
@@ -25,6 +32,27 @@ enum class EngineMode {
     STRICT  // Full speed: the engine is limited to basic content inside the templates.
 };
 
+// A compile hook loaded from a native shared library (see include/eryn_plugin.h).
+// Unlike the JavaScript hook, it doesn't need the bridge, so it can be called from any thread.
+class HookPlugin {
+    void*             handle;
+    eryn_transform_fn transform;
+    string            path;
+
+    HookPlugin(void* handle, eryn_transform_fn transform, const string& path);
+
+    public:
+    HookPlugin(const HookPlugin&) = delete;
+    HookPlugin& operator=(const HookPlugin&) = delete;
+    ~HookPlugin();
+
+    // Returns null and sets the error if the library can't be loaded, or if it doesn't export the transform.
+    static std::shared_ptr<HookPlugin> load(const string& path, string& error);
+
+    // Same as Bridge::call_hook.
+    bool call(Buffer& buffer, const char* origin) const;
+};
+
 struct Options {
     struct {
         bool bypassCache            : 1;
@@ -37,11 +65,27 @@ struct Options {
         bool cloneBackups           : 1;
         bool cloneLocalInLoops      : 1;
         bool debugDumpOSH           : 1;
+        bool inlineStaticComponents : 1;
+        bool mergePlaintext         : 1;
+        bool foldConstants          : 1;
+        bool minifyHTML             : 1;
+        bool batchCompileHook       : 1;
+        bool memoizeCompileHook     : 1;
+        bool memoizeComponents      : 1;
     } flags;
 
     EngineMode mode;
     string     workingDir;
 
+    // Components whose OSH is bigger than this (in bytes) are never inlined.
+    size_t inlineThreshold;
+
+    // Compile-time constants (name -> JavaScript literal). They are replaced in every template, conditional, loop iterable
+    // and component context (but not in property names, strings and regex literals, or where a variable or parameter with
+    // the same name hides them). Void templates are only changed if they become constant. The scripts that end up constant
+    // are then folded when compiling.
+    std::unordered_map<string, string> defines;
+
     struct {
         char escape;
 
@@ -64,20 +108,233 @@ struct Options {
         string componentSelf;
     } templates;
 
-    BridgeHook compileHook;
+    BridgeHook                  compileHook;
+    std::shared_ptr<HookPlugin> compilePlugin; // Used instead of the compile hook, if set.
 
     Options();
 };
 
+// Whether the OSH (a component) can be rendered without side effects, so that it always renders the same way for
+// the same context. Nested components aren't checked, since they may not be compiled yet (see optimizer.cxx).
+bool is_side_effect_free(ConstBuffer osh);
+
+// Compile hook results, shared by all files (origin and segment content -> result).
+typedef std::unordered_map<string, string> HookMemo;
+
 class Cache {
-    std::unordered_map<string, ConstBuffer> entries;
+    struct Entry {
+        ConstBuffer osh;
+        // Owns the OSH memory. Renders that reference the OSH after they return (see ScatterOutput) share it,
+        // so the memory outlives the entry if the entry is replaced or removed in the meantime.
+        std::shared_ptr<const uint8_t> owner;
 
-    public:
-    ~Cache();
+        // Whether the OSH is plaintext only, in which case rendering it always outputs 'text' (which points into the OSH).
+        bool        isStatic;
+        ConstBuffer text;
+
+        // Whether rendering the OSH has no side effects, and its output only depends on the context (see is_side_effect_free()).
+        // It's only needed for memoizing components, so it's found on the first is_pure() call instead of when compiling.
+        bool        purityKnown;
+        bool        isPure;
+    };
 
+    std::unordered_map<string, Entry> entries;
+
+    // Which entries were built using other entries (e.g. inlined components).
+    // When an entry changes, the entries that depend on it must be compiled again.
+    std::unordered_map<string, std::unordered_set<string>> dependencies;
+
+    // Decaying estimate of the rendered size of each entry (see record_output_size()).
+    std::unordered_map<string, size_t> outputSizes;
+
+    public:
     void         add(const string& key, ConstBuffer&& value);
+    void         remove(const string& key);
+    void         clear();
     ConstBuffer& get(const string& key);
     bool         has(const string& key) const;
+
+    // Keeps the OSH memory of the entry alive for as long as the returned pointer (or a copy of it) exists.
+    std::shared_ptr<const uint8_t> share(const string& key);
+
+    // Returns false if the entry doesn't exist or isn't static. Otherwise, 'text' is what the entry always renders to.
+    bool get_static(const string& key, ConstBuffer& text) const;
+    // Returns false if the entry doesn't exist or isn't side-effect free.
+    bool is_pure(const string& key);
+
+    void                track(const string& key, const string& dependency);
+    void                untrack(const string& key);
+    std::vector<string> dependents(const string& dependency) const;
+
+    // How many bytes a render of this entry is expected to output (0 if unknown).
+    size_t output_size(const string& key) const;
+    void   record_output_size(const string& key, size_t size);
+};
+
+// Recycles the memory of rendered outputs, so that steady traffic stops allocating (see pool.cxx for the size classes).
+// Outputs are given back when their JS buffers are collected, which happens on the thread of their environment,
+// so there's one pool per thread.
+class OutputPool {
+    public:
+    struct Stats {
+        size_t hits;     // Outputs that got a recycled block.
+        size_t misses;   // Outputs that needed a new block.
+        size_t recycled; // Blocks given back to the pool.
+        size_t freed;    // Blocks given back when the pool was full (or too small to be pooled).
+        size_t blocks;   // Blocks in the pool.
+        size_t bytes;
+        size_t external; // Bytes of outputs held by JS buffers (reported to V8).
+    };
+
+    OutputPool();
+    ~OutputPool();
+
+    OutputPool(const OutputPool&) = delete;
+    OutputPool& operator=(const OutputPool&) = delete;
+
+    static OutputPool& local();
+
+    // Returns an empty buffer with room for at least 'size' bytes (rounded up to the size class).
+    Buffer acquire(size_t size);
+    // Takes back a block of at least 'capacity' bytes (from acquire, or any other remem allocation), or frees it if the pool is full.
+    void   release(uint8_t* data, size_t capacity);
+    void   clear();
+    // Counts the bytes of outputs that are given to JS (positive) or collected (negative).
+    void   track_external(int64_t change);
+
+    const Stats& stats() const;
+
+    private:
+    std::vector<std::vector<uint8_t*>> classes;
+    Stats                              poolStats;
+};
+
+// A native thread that runs tasks in the order they were submitted, for work that doesn't need V8 (such as file IO).
+// Tasks must not use remem, which isn't thread-safe.
+class IOThread {
+    public:
+    IOThread();
+    ~IOThread();
+
+    IOThread(const IOThread&) = delete;
+    IOThread& operator=(const IOThread&) = delete;
+
+    void submit(std::function<void()>&& task);
+    // Blocks until the condition is true. It's checked whenever a task finishes.
+    void wait_until(const std::function<bool()>& condition);
+    // Blocks until all submitted tasks are done.
+    void wait_all();
+
+    private:
+    std::deque<std::function<void()>> tasks;
+    size_t                            pending; // Tasks that were submitted but aren't done.
+    bool                              stopping;
+
+    std::mutex              lock;
+    std::condition_variable available; // Signaled when a task is submitted.
+    std::condition_variable finished;  // Signaled when a task is done.
+
+    // Declared last, so that it starts after the rest is initialized.
+    std::thread thread;
+
+    void work();
+};
+
+// Memory that renders reuse (see renderer.cxx).
+struct RenderScratch;
+
+// The output of a scatter render, as a list of segments to be written in order (e.g. with writev).
+// Large static plaintext isn't copied: its segments point into the cached OSH, which 'owners' keeps alive.
+// Everything else is written to 'dynamic', and its segments are ranges of it.
+struct ScatterOutput {
+    struct Segment {
+        const uint8_t* data;   // Null if the segment is in 'dynamic'.
+        size_t         offset; // In 'dynamic' (which can move while rendering, so data can't point into it).
+        size_t         size;
+    };
+
+    std::vector<Segment>                        segments;
+    std::vector<std::shared_ptr<const uint8_t>> owners;
+    Buffer                                      dynamic;
+
+    ScatterOutput();
+
+    // Returns a pointer to the start of the segment.
+    const uint8_t* data(const Segment& segment) const;
+
+    void hold(std::shared_ptr<const uint8_t>&& owner);
+    void reference(const uint8_t* data, size_t size);
+    // Ends the dynamic segment that is being written (called when the render is done).
+    void close();
+
+    private:
+    size_t dynamicStart;
+};
+
+class Engine;
+
+// A render that produces its output in chunks, so that it can be sent before the whole page is rendered.
+// The chunks are written to a buffer that is reused, so a chunk is only valid until the next call to next().
+// The first chunk is the static beginning of the file (if it has one), which is ready before any script is evaluated.
+// A render can also be split in time slices, so that it doesn't block the event loop for too long.
+class RenderStream {
+    public:
+    // The stream owns the bridge, and uses its own scratch memory (other renders can run between chunks).
+    // If 'chunkSize' is 0, the output isn't split, and the whole of it is taken at the end (see take()).
+    RenderStream(Engine& engine, std::unique_ptr<Bridge>&& bridge, const char* path, size_t chunkSize, bool frozen = false);
+    ~RenderStream();
+
+    RenderStream(const RenderStream&) = delete;
+    RenderStream& operator=(const RenderStream&) = delete;
+
+    // Renders the next chunk (at least 'chunkSize' bytes, unless it's the first or the last one, or the time slice ended).
+    // Returns false if the render is already done, in which case the chunk is empty.
+    bool next(ConstBuffer& chunk);
+    bool done() const;
+    bool chunked() const;
+
+    // Makes next() also stop after this many microseconds (0 to disable).
+    void        set_time_slice(uint64_t microseconds);
+    // Aborts the render (see RenderingAbortedException) once this many microseconds have passed since the stream was created.
+    void        set_timeout(uint64_t microseconds);
+    // For streams without chunks. Gives the whole output to the caller, once the render is done.
+    ConstBuffer take();
+
+    // The JS values of the render can't be kept between native calls, so they must be stashed
+    // after every call, and restored (with a restoring stash) before the next one.
+    void stash(BridgeStash& stash);
+
+    private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+// An item of a batch render (see Engine::render_many).
+struct BatchItem {
+    string       path;
+    BridgeBackup context;
+    BridgeShared shared;
+    bool         frozen; // Whether 'shared' is the frozen shared object.
+};
+
+struct BatchOutput {
+    ConstBuffer                    data;
+    size_t                         capacity; // Of the output from the OutputPool (0 for static entries).
+    std::shared_ptr<const uint8_t> owner;    // Only set for static entries, which point into the cache.
+};
+
+// A page of a static site: the file to render, the JSON file that is the context (optional), and where to write the output.
+struct SiteItem {
+    string path;
+    string data;
+    string output;
+};
+
+struct SiteStats {
+    size_t rendered;
+    size_t written;
+    size_t skipped; // Outputs that were the same as the existing files.
+    size_t bytes;   // Of the written outputs.
 };
 
 class Engine {
@@ -85,17 +342,63 @@ class Engine {
     Options opts;
     Cache   cache;
 
+    // Variants of the cached OSH, specialized against the frozen shared object.
+    Cache specialized;
+
+    // Only used when memoizeCompileHook is set. Must be cleared when the hook changes.
+    HookMemo hookMemo;
+
+    Engine();
+    ~Engine();
+
     void compile(BridgeCompileData bridge, const char* path);
     void compile_string(BridgeCompileData bridge, const char* alias, const char* str);
     void compile_dir(BridgeCompileData bridge, const char* path, std::vector<string> filters);
 
-    ConstBuffer render(Bridge& bridge, const char* path);
-    ConstBuffer render_string(Bridge& bridge, const char* alias);
+    // If 'frozen' is true, the shared object of the bridge is the frozen one, so the specialized OSH is rendered.
+    // If 'owner' is set and the entry is static, the cached text is returned without copying, and 'owner' keeps it alive.
+    // Otherwise, the caller owns the returned buffer.
+    // If 'timeout' is set, the render is aborted with RenderingAbortedException after that many microseconds.
+    // If 'capacity' is set, the output comes from the OutputPool and isn't shrunk. Its capacity is written there,
+    // so that it can be given back to the pool.
+    ConstBuffer render(Bridge& bridge, const char* path, bool frozen = false, std::shared_ptr<const uint8_t>* owner = nullptr, uint64_t timeout = 0,
+                       size_t* capacity = nullptr);
+    ConstBuffer render_string(Bridge& bridge, const char* alias, bool frozen = false, std::shared_ptr<const uint8_t>* owner = nullptr, uint64_t timeout = 0,
+                              size_t* capacity = nullptr);
+    // Renders to memory that the caller owns, and returns the size of the output. If it's larger than 'capacity',
+    // the target is filled and the rest of the output is written to 'overflow' (which must be empty).
+    size_t      render_into(Bridge& bridge, const char* path, uint8_t* target, size_t capacity, Buffer& overflow, bool frozen = false, uint64_t timeout = 0);
+    // Renders the items one after the other, with the same bridge and scratch memory. If 'joined' is set, the outputs are
+    // written to it back to back, and only their sizes are set in 'outputs'. Otherwise, the caller owns the outputs
+    // (like for render with 'capacity' set, and 'owner' if 'shareStatic' is true). The timeout is for the whole batch.
+    // If an item fails, the outputs are released and 'failed' is set to its index.
+    void        render_many(Bridge& bridge, const std::vector<BatchItem>& items, Buffer* joined, std::vector<BatchOutput>& outputs, size_t& failed,
+                            bool shareStatic = false, uint64_t timeout = 0);
+    // Renders to a list of segments instead of a single buffer (see ScatterOutput).
+    void        render_scatter(Bridge& bridge, const char* path, ScatterOutput& output, bool frozen = false, uint64_t timeout = 0);
+
+    // Renders the items (one after the other, with the same bridge) to their output files. The data files are read and the outputs
+    // are written by an IOThread, while the next items are rendered. If 'skipUnchanged' is set, outputs that are the same as the
+    // existing files aren't written. If an item fails, the pending work is finished and 'failed' is set to its index.
+    SiteStats   build_site(Bridge& bridge, const std::vector<SiteItem>& items, bool skipUnchanged, bool frozen, size_t& failed);
+
+    ConstBuffer& specialize(BridgeCompileData bridge, BridgeShared shared, const char* path);
+    void         freeze_shared();
+
+    bool is_compiling(const string& path) const;
 
     private:
+    // Files that are currently being compiled (a file can trigger the compilation of its components).
+    std::unordered_set<string> compiling;
+
+    // Kept between renders, so that rendering stops allocating scratch memory once it warms up.
+    std::unique_ptr<RenderScratch> scratch;
+
     void        compile_dir(BridgeCompileData bridge, const char* path, const char* rel, const FilterInfo& info);
+    void        compile_dependents(BridgeCompileData bridge, const char* path);
     ConstBuffer compile_file(BridgeCompileData bridge, const char* path);
     ConstBuffer compile_bytes(BridgeCompileData bridge, ConstBuffer& inputBuffer, const char* wd, const char* path = "");
+    ConstBuffer optimize(BridgeCompileData bridge, ConstBuffer osh, const char* path, bool isFile);
 };
 
 class InternalException : public std::exception {
@@ -140,4 +443,20 @@ class RenderingException : public std::exception {
 
     const char* what() const noexcept override;
 };
+
+// How far a render got before it was aborted.
+struct RenderProgress {
+    size_t   bytes;      // Output so far.
+    size_t   iterations; // Loop iterations.
+    size_t   components; // Components rendered (or started).
+    uint64_t elapsed;    // Microseconds.
+};
+
+// Thrown when a render runs past its deadline.
+class RenderingAbortedException : public RenderingException {
+    public:
+    RenderProgress progress;
+
+    RenderingAbortedException(const char* path, RenderProgress progress);
+};
 } // namespace Eryn
\ No newline at end of file
@@ -95,4 +95,17 @@ Eryn::RenderingException::RenderingException(const char* msg, const char* descri
 
 const char* Eryn::RenderingException::what() const noexcept {
     return message.c_str();
-}
\ No newline at end of file
+}
+
+Eryn::RenderingAbortedException::RenderingAbortedException(const char* path, RenderProgress progress)
+  : RenderingException("Render aborted", "deadline exceeded", path), progress(progress) {
+    message += " after ";
+    message += std::to_string(progress.elapsed / 1000);
+    message += "ms (";
+    message += std::to_string(progress.bytes);
+    message += " bytes, ";
+    message += std::to_string(progress.iterations);
+    message += " loop iterations, ";
+    message += std::to_string(progress.components);
+    message += " components)";
+}
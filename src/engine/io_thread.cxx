@@ -0,0 +1,59 @@
+#include "engine.hxx"
+
+Eryn::IOThread::IOThread() : pending(0), stopping(false), thread(&IOThread::work, this) {
+}
+
+Eryn::IOThread::~IOThread() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+
+    available.notify_one();
+    thread.join();
+}
+
+void Eryn::IOThread::submit(std::function<void()>&& task) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        tasks.push_back(std::move(task));
+        ++pending;
+    }
+
+    available.notify_one();
+}
+
+void Eryn::IOThread::wait_until(const std::function<bool()>& condition) {
+    std::unique_lock<std::mutex> guard(lock);
+    finished.wait(guard, condition);
+}
+
+void Eryn::IOThread::wait_all() {
+    wait_until([this]() { return pending == 0; });
+}
+
+void Eryn::IOThread::work() {
+    std::unique_lock<std::mutex> guard(lock);
+
+    while(true) {
+        available.wait(guard, [this]() { return stopping || !tasks.empty(); });
+
+        // Stops only when there's nothing left to do.
+        if(tasks.empty()) {
+            return;
+        }
+
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+
+        guard.unlock();
+        task();
+        task = nullptr;
+        guard.lock();
+
+        // The counter is changed with the lock held, so that a waiting thread can't miss the signal.
+        --pending;
+        finished.notify_all();
+    }
+}
@@ -0,0 +1,1378 @@
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+
+#include "engine.hxx"
+
+#include "../def/osh.dxx"
+#include "../def/logging.dxx"
+
+#include "../../lib/str.hxx"
+#include "../../lib/remem.hxx"
+#include "../../lib/buffer.hxx"
+#include "../../lib/mem.hxx"
+
+using Eryn::InternalException;
+
+static const BDP::Header BDP832 = BDP::Header(8, 32);
+
+struct OshNode;
+
+// A branch of a conditional chain (conditional, else conditional or else).
+struct OshBranch {
+    bool        isElse;
+    ConstBuffer condition; // Empty for else branches.
+
+    std::vector<OshNode> body;
+};
+
+// The optimizer works on a tree instead of the flat OSH, so that passes can move and remove
+// whole templates without patching the jump indices by hand. The indices are computed again
+// when the tree is written back as OSH.
+struct OshNode {
+    uint8_t     marker;
+    ConstBuffer value; // Plaintext, template content, loop iterator or component path.
+    ConstBuffer extra; // Loop iterable or component context.
+
+    std::vector<OshNode>   body;     // Loop and component body.
+    std::vector<OshBranch> branches; // Conditional chain.
+
+    OshNode(uint8_t marker) : marker(marker) { }
+    OshNode(uint8_t marker, ConstBuffer value) : marker(marker), value(value) { }
+};
+
+struct Optimizer {
+    Eryn::Engine&  engine;
+    Eryn::Options& opts;
+
+    Eryn::BridgeCompileData bridge;
+    Eryn::BridgeShared      shared; // Only set when specializing against a frozen shared object.
+
+    const char* path;
+
+    // Copies of the inlined components. The nodes point inside them until the output is emitted.
+    std::deque<std::string> storage;
+
+    Optimizer(Eryn::Engine& engine, Eryn::BridgeCompileData bridge, const char* path)
+        : engine(engine), opts(engine.opts), bridge(bridge), path(path) { }
+
+    bool load_component(const std::string& component, std::vector<OshNode>& nodes);
+    void inline_components(std::vector<OshNode>& nodes);
+    void merge_plaintext(std::vector<OshNode>& nodes);
+    void fold_constants(std::vector<OshNode>& nodes);
+
+    ConstBuffer substitute_defines(ConstBuffer script, bool onlyConstant);
+};
+
+static void read_pair(const ConstBuffer& osh, size_t& index, uint8_t& marker, ConstBuffer& value) {
+    size_t nameLength;
+    size_t valueLength;
+
+    BDP::bytesToLength(nameLength, osh.data + index, BDP832.NAME_LENGTH_BYTE_SIZE);
+    index += BDP832.NAME_LENGTH_BYTE_SIZE;
+    marker = osh.data[index];
+    index += nameLength;
+
+    BDP::bytesToLength(valueLength, osh.data + index, BDP832.VALUE_LENGTH_BYTE_SIZE);
+    index += BDP832.VALUE_LENGTH_BYTE_SIZE;
+    value = ConstBuffer(osh.data + index, valueLength);
+    index += valueLength;
+}
+
+// Splits a value that contains 2 BDP values (loop iterator + iterable, component path + context).
+static void split_value(const ConstBuffer& value, ConstBuffer& left, ConstBuffer& right) {
+    size_t index = 0;
+    size_t length;
+
+    BDP::bytesToLength(length, value.data, BDP832.VALUE_LENGTH_BYTE_SIZE);
+    index += BDP832.VALUE_LENGTH_BYTE_SIZE;
+    left = ConstBuffer(value.data + index, length);
+    index += length;
+
+    BDP::bytesToLength(length, value.data + index, BDP832.VALUE_LENGTH_BYTE_SIZE);
+    index += BDP832.VALUE_LENGTH_BYTE_SIZE;
+    right = ConstBuffer(value.data + index, length);
+}
+
+static uint8_t peek_marker(const ConstBuffer& osh, size_t index) {
+    return osh.data[index + BDP832.NAME_LENGTH_BYTE_SIZE];
+}
+
+static void expect_marker(const ConstBuffer& osh, size_t& index, uint8_t expected) {
+    uint8_t     marker;
+    ConstBuffer value;
+
+    if(index >= osh.size || peek_marker(osh, index) != expected) {
+        throw ERYN_INTERNAL_EXCEPTION(std::string("Malformed OSH: expected marker '") + (char) expected + "' at index " + std::to_string(index));
+    }
+
+    read_pair(osh, index, marker, value);
+}
+
+// Parses nodes until the end of the input, or until a marker that closes the current body.
+// The index is left at the closing marker, which is consumed by the caller.
+static void parse_nodes(const ConstBuffer& osh, size_t& index, std::vector<OshNode>& nodes) {
+    while(index < osh.size) {
+        switch(peek_marker(osh, index)) {
+            case *OSH_TEMPLATE_ELSE_START:
+            case *OSH_TEMPLATE_ELSE_CONDITIONAL_START:
+            case *OSH_TEMPLATE_CONDITIONAL_BODY_END:
+            case *OSH_TEMPLATE_LOOP_BODY_END:
+            case *OSH_TEMPLATE_COMPONENT_BODY_END:
+                return;
+        }
+
+        uint8_t     marker;
+        ConstBuffer value;
+
+        read_pair(osh, index, marker, value);
+
+        switch(marker) {
+            case *OSH_PLAINTEXT:
+            case *OSH_TEMPLATE:
+            case *OSH_TEMPLATE_VOID:
+                nodes.emplace_back(marker, value);
+                break;
+            case *OSH_TEMPLATE_CONDITIONAL_START: {
+                OshNode node(marker);
+
+                index += 2 * OSH_FORMAT;
+                node.branches.push_back({ false, value, { } });
+                parse_nodes(osh, index, node.branches.back().body);
+
+                bool searching = true;
+
+                while(searching) {
+                    if(index >= osh.size) {
+                        throw ERYN_INTERNAL_EXCEPTION("Malformed OSH: unexpected end of conditional template");
+                    }
+
+                    read_pair(osh, index, marker, value);
+
+                    switch(marker) {
+                        case *OSH_TEMPLATE_ELSE_CONDITIONAL_START:
+                            index += 2 * OSH_FORMAT;
+                            node.branches.push_back({ false, value, { } });
+                            parse_nodes(osh, index, node.branches.back().body);
+                            break;
+                        case *OSH_TEMPLATE_ELSE_START:
+                            node.branches.push_back({ true, ConstBuffer(nullptr, 0), { } });
+                            parse_nodes(osh, index, node.branches.back().body);
+                            break;
+                        case *OSH_TEMPLATE_CONDITIONAL_BODY_END:
+                            searching = false;
+                            break;
+                        default:
+                            throw ERYN_INTERNAL_EXCEPTION(std::string("Malformed OSH: unexpected marker '") + (char) marker + "' in conditional template");
+                    }
+                }
+
+                nodes.push_back(std::move(node));
+                break;
+            }
+            case *OSH_TEMPLATE_LOOP_START:
+            case *OSH_TEMPLATE_LOOP_REVERSE_START: {
+                OshNode node(marker);
+
+                split_value(value, node.value, node.extra);
+                index += OSH_FORMAT;
+
+                parse_nodes(osh, index, node.body);
+                expect_marker(osh, index, *OSH_TEMPLATE_LOOP_BODY_END);
+                index += OSH_FORMAT;
+
+                nodes.push_back(std::move(node));
+                break;
+            }
+            case *OSH_TEMPLATE_COMPONENT: {
+                OshNode node(marker);
+
+                split_value(value, node.value, node.extra);
+                index += OSH_FORMAT;
+
+                parse_nodes(osh, index, node.body);
+                expect_marker(osh, index, *OSH_TEMPLATE_COMPONENT_BODY_END);
+
+                nodes.push_back(std::move(node));
+                break;
+            }
+            default:
+                throw ERYN_INTERNAL_EXCEPTION(std::string("Malformed OSH: unknown marker '") + (char) marker + "' at index " + std::to_string(index));
+        }
+    }
+}
+
+static std::vector<OshNode> parse_osh(const ConstBuffer& osh) {
+    std::vector<OshNode> nodes;
+    size_t index = 0;
+
+    parse_nodes(osh, index, nodes);
+
+    if(index < osh.size) {
+        throw ERYN_INTERNAL_EXCEPTION(std::string("Malformed OSH: unexpected marker '") + (char) peek_marker(osh, index) + "' at index " + std::to_string(index));
+    }
+
+    return nodes;
+}
+
+// Writes the nodes as OSH. The jump indices are computed exactly like in the compiler.
+static void emit_nodes(const std::vector<OshNode>& nodes, Buffer& output) {
+    for(const auto& node : nodes) {
+        switch(node.marker) {
+            case *OSH_PLAINTEXT:
+            case *OSH_TEMPLATE:
+            case *OSH_TEMPLATE_VOID:
+                output.write_bdp_pair(BDP832, &node.marker, 1, node.value.data, node.value.size);
+                break;
+            case *OSH_TEMPLATE_CONDITIONAL_START: {
+                // Where each branch starts, and where its body starts.
+                std::vector<size_t> starts;
+                std::vector<size_t> bodies;
+
+                for(size_t i = 0; i < node.branches.size(); ++i) {
+                    const auto& branch = node.branches[i];
+
+                    starts.push_back(output.size);
+
+                    if(branch.isElse) {
+                        output.write_bdp_pair(BDP832, OSH_TEMPLATE_ELSE_START_MARKER, OSH_TEMPLATE_ELSE_START_LENGTH, nullptr, 0);
+                    } else {
+                        const uint8_t* marker = (i == 0) ? OSH_TEMPLATE_CONDITIONAL_START_MARKER : OSH_TEMPLATE_ELSE_CONDITIONAL_START_MARKER;
+
+                        output.write_bdp_pair(BDP832, marker, 1, branch.condition.data, branch.condition.size);
+                        output.repeat(0, 2 * OSH_FORMAT);
+                    }
+
+                    bodies.push_back(output.size);
+                    emit_nodes(branch.body, output);
+                }
+
+                size_t bodyEnd = output.size;
+                output.write_bdp_pair(BDP832, OSH_TEMPLATE_CONDITIONAL_BODY_END_MARKER, OSH_TEMPLATE_CONDITIONAL_BODY_END_LENGTH, nullptr, 0);
+
+                for(size_t i = 0; i < node.branches.size(); ++i) {
+                    if(node.branches[i].isElse) {
+                        continue;
+                    }
+
+                    size_t next = (i + 1 < node.branches.size()) ? starts[i + 1] : bodyEnd;
+
+                    // Jumps at the start of the next branch, or at the end when the condition is true.
+                    output.write_length(bodies[i] - 2 * OSH_FORMAT, next - bodies[i], OSH_FORMAT);
+                    output.write_length(bodies[i] - OSH_FORMAT, output.size - next, OSH_FORMAT);
+                }
+
+                break;
+            }
+            case *OSH_TEMPLATE_LOOP_START:
+            case *OSH_TEMPLATE_LOOP_REVERSE_START: {
+                Buffer tempBuffer;
+
+                tempBuffer.write_bdp_value(BDP832, node.value.data, node.value.size);
+                tempBuffer.write_bdp_value(BDP832, node.extra.data, node.extra.size);
+
+                output.write_bdp_name(BDP832, &node.marker, 1);
+                output.write_bdp_value(BDP832, tempBuffer.data, tempBuffer.size);
+                output.repeat(0, OSH_FORMAT);
+
+                size_t body = output.size;
+
+                emit_nodes(node.body, output);
+                output.write_bdp_pair(BDP832, OSH_TEMPLATE_LOOP_BODY_END_MARKER, OSH_TEMPLATE_LOOP_BODY_END_LENGTH, nullptr, 0);
+
+                output.write_length(body - OSH_FORMAT, output.size - body + OSH_FORMAT, OSH_FORMAT);
+                output.write_length(output.size + OSH_FORMAT - body, OSH_FORMAT);
+                break;
+            }
+            case *OSH_TEMPLATE_COMPONENT: {
+                Buffer tempBuffer;
+
+                tempBuffer.write_bdp_value(BDP832, node.value.data, node.value.size);
+                tempBuffer.write_bdp_value(BDP832, node.extra.data, node.extra.size);
+
+                output.write_bdp_name(BDP832, &node.marker, 1);
+                output.write_bdp_value(BDP832, tempBuffer.data, tempBuffer.size);
+                output.repeat(0, OSH_FORMAT);
+
+                size_t body = output.size;
+
+                emit_nodes(node.body, output);
+                output.write_length(body - OSH_FORMAT, output.size - body, OSH_FORMAT);
+                output.write_bdp_pair(BDP832, OSH_TEMPLATE_COMPONENT_BODY_END_MARKER, OSH_TEMPLATE_COMPONENT_BODY_END_LENGTH, nullptr, 0);
+                break;
+            }
+        }
+    }
+}
+
+// Whether the script reads something that depends on the scope it's evaluated in.
+// This is deliberately pessimistic: a match inside a string literal also counts.
+static bool is_scope_dependent(const ConstBuffer& script) {
+    static const char* const identifiers[] = { "context", "local", "eval", "arguments", "Function" };
+
+    size_t index = 0;
+
+    while(index < script.size) {
+        if(!str::valid_in_token(script.data[index])) {
+            ++index;
+            continue;
+        }
+
+        size_t tokenStart = index;
+
+        while(index < script.size && str::valid_in_token(script.data[index])) {
+            ++index;
+        }
+
+        // Property access, such as shared.context.
+        if(tokenStart > 0 && script.data[tokenStart - 1] == '.') {
+            continue;
+        }
+
+        for(auto identifier : identifiers) {
+            if(index - tokenStart == strlen(identifier) && mem::cmp(script.data + tokenStart, identifier, index - tokenStart)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool is_content_marker(const OshNode& node) {
+    return node.marker == *OSH_TEMPLATE && node.value.size == OSH_TEMPLATE_CONTENT_LENGTH &&
+           mem::cmp(node.value.data, OSH_TEMPLATE_CONTENT_MARKER, OSH_TEMPLATE_CONTENT_LENGTH);
+}
+
+// Whether the nodes render the same way regardless of the component scope (context and local)
+// they are placed in. Loops are never portable, because they assign the iterator to the local object.
+static bool is_portable(const std::vector<OshNode>& nodes) {
+    for(const auto& node : nodes) {
+        switch(node.marker) {
+            case *OSH_PLAINTEXT:
+                break;
+            case *OSH_TEMPLATE:
+                if(is_content_marker(node)) {
+                    return false;
+                }
+                // Fallthrough
+            case *OSH_TEMPLATE_VOID:
+                if(is_scope_dependent(node.value)) {
+                    return false;
+                }
+                break;
+            case *OSH_TEMPLATE_CONDITIONAL_START:
+                for(const auto& branch : node.branches) {
+                    if((!branch.isElse && is_scope_dependent(branch.condition)) || !is_portable(branch.body)) {
+                        return false;
+                    }
+                }
+                break;
+            case *OSH_TEMPLATE_COMPONENT:
+                // The component does its own context switching, but its context and content belong to this scope.
+                if(is_scope_dependent(node.extra) || !is_portable(node.body)) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Places the content (the body of the component) at the content marker of the component.
+// The content marker must appear exactly once, and outside of conditionals and nested components,
+// so the content is still rendered exactly once.
+static bool fill_content(std::vector<OshNode>& nodes, std::vector<OshNode>& content) {
+    size_t slot = nodes.size();
+
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        if(is_content_marker(nodes[i])) {
+            if(slot != nodes.size()) {
+                return false;
+            }
+
+            slot = i;
+        }
+    }
+
+    if(slot == nodes.size()) {
+        return false;
+    }
+
+    nodes.erase(nodes.begin() + slot);
+
+    if(!is_portable(nodes)) {
+        return false;
+    }
+
+    nodes.insert(nodes.begin() + slot, std::make_move_iterator(content.begin()), std::make_move_iterator(content.end()));
+    return true;
+}
+
+// Loads the OSH of a component as nodes, compiling the component if needed.
+bool Optimizer::load_component(const std::string& component, std::vector<OshNode>& nodes) {
+    // Recursive components can't be inlined.
+    if(engine.is_compiling(component)) {
+        return false;
+    }
+
+    if(!engine.cache.has(component)) {
+        if(opts.flags.throwOnMissingEntry) {
+            return false;
+        }
+
+        try {
+            engine.compile(bridge, component.c_str());
+        } catch(Eryn::CompilationException& e) {
+            UNREFERENCED(e); // The exception data is used in debug mode. Suppress release warnings.
+
+            // The error will surface when (and if) the component is rendered.
+            LOG_DEBUG("Cannot inline component '%s':\n%s", component.c_str(), e.what());
+            return false;
+        }
+    }
+
+    auto& entry = engine.cache.get(component);
+
+    if(entry.size > opts.inlineThreshold) {
+        return false;
+    }
+
+    // Compiling other components may replace this cache entry, so work on a copy.
+    storage.emplace_back(reinterpret_cast<const char*>(entry.data), entry.size);
+    nodes = parse_osh(ConstBuffer(storage.back().data(), storage.back().size()));
+
+    return true;
+}
+
+// Replaces components without context by the OSH of the component itself. If the component has content,
+// the content is placed where the component would render it, so it doesn't need to be captured when rendering.
+void Optimizer::inline_components(std::vector<OshNode>& nodes) {
+    std::vector<OshNode> result;
+    result.reserve(nodes.size());
+
+    for(auto& node : nodes) {
+        switch(node.marker) {
+            case *OSH_TEMPLATE_CONDITIONAL_START:
+                for(auto& branch : node.branches) {
+                    inline_components(branch.body);
+                }
+                break;
+            case *OSH_TEMPLATE_LOOP_START:
+            case *OSH_TEMPLATE_LOOP_REVERSE_START:
+                inline_components(node.body);
+                break;
+            case *OSH_TEMPLATE_COMPONENT: {
+                inline_components(node.body);
+
+                if(node.extra.size != 0) {
+                    break;
+                }
+
+                std::string component(reinterpret_cast<const char*>(node.value.data), node.value.size);
+                std::vector<OshNode> inlined;
+
+                if(!load_component(component, inlined)) {
+                    break;
+                }
+
+                if(node.body.empty()) {
+                    if(!is_portable(inlined)) {
+                        break;
+                    }
+                } else if(opts.flags.throwOnEmptyContent || !fill_content(inlined, node.body)) {
+                    // Empty content must be detected when rendering, so it can't be flattened.
+                    break;
+                }
+
+                LOG_DEBUG("Inlining component '%s'", component.c_str());
+
+                engine.cache.track(path, component);
+
+                for(auto& inlinedNode : inlined) {
+                    result.push_back(std::move(inlinedNode));
+                }
+
+                continue;
+            }
+        }
+
+        result.push_back(std::move(node));
+    }
+
+    nodes = std::move(result);
+}
+
+// Whether the script only contains literals (numbers, strings, true, false, null, undefined, NaN, Infinity)
+// and operators. Such scripts have no side effects and always give the same result, so they can be evaluated
+// when compiling. Identifiers, calls, brackets and template strings are never constant.
+// If 'allowShared' is true, the script can also read the shared object (e.g. shared.site["name"]), which is then
+// expected to be frozen.
+static bool is_constant(const ConstBuffer& script, bool allowShared) {
+    static const char* const literals[] = { "true", "false", "null", "undefined", "NaN", "Infinity" };
+    static const char* const operators  = "+-*/%!~^&|<>=?:,";
+    static const char* const numeric    = "0123456789abcdefABCDEFxXoObBn_.";
+
+    size_t index    = 0;
+    bool   hasValue = false;
+
+    // Parentheses and brackets must be balanced, so the script can't escape the expression it's placed in.
+    std::vector<uint8_t> groups;
+
+    // The last character that is not blank, used to detect calls and property access.
+    uint8_t last = 0;
+
+    while(index < script.size) {
+        uint8_t c = script.data[index];
+
+        if(str::is_blank(c)) {
+            ++index;
+            continue;
+        }
+
+        if(c == '"' || c == '\'') {
+            ++index;
+
+            while(index < script.size && script.data[index] != c && script.data[index] != '\n') {
+                // Skip the escaped character.
+                index += (script.data[index] == '\\') ? 2 : 1;
+            }
+
+            if(index >= script.size || script.data[index] != c) {
+                return false;
+            }
+
+            ++index;
+            hasValue = true;
+        } else if((c >= '0' && c <= '9') || (c == '.' && index + 1 < script.size && script.data[index + 1] >= '0' && script.data[index + 1] <= '9')) {
+            size_t dots = 0;
+
+            // Only one dot, so 1..toString is not a number.
+            while(index < script.size && script.data[index] != '\0' && strchr(numeric, script.data[index]) != nullptr) {
+                dots += (script.data[index] == '.');
+                ++index;
+            }
+
+            if(dots > 1 || (index < script.size && str::valid_in_token(script.data[index]))) {
+                return false;
+            }
+
+            hasValue = true;
+        } else if(str::valid_in_token(c)) {
+            size_t tokenStart = index;
+
+            while(index < script.size && str::valid_in_token(script.data[index])) {
+                ++index;
+            }
+
+            ConstBuffer token(script.data + tokenStart, index - tokenStart);
+            bool valid = false;
+
+            if(allowShared) {
+                // Property access, or the shared object itself.
+                valid = (last == '.') || (token.size == 6 && mem::cmp(token.data, "shared", 6));
+            }
+
+            for(auto literal : literals) {
+                if(!valid && last != '.' && token.size == strlen(literal) && mem::cmp(token.data, literal, token.size)) {
+                    valid = true;
+                }
+            }
+
+            if(!valid) {
+                return false;
+            }
+
+            hasValue = true;
+            last     = script.data[index - 1];
+            continue;
+        } else if(c == '.' && allowShared && (str::valid_in_token(last) || last == ']' || last == ')')) {
+            ++index;
+        } else if(c == '(' || (c == '[' && allowShared)) {
+            // A parenthesis after a value is a call.
+            if(c == '(' && (str::valid_in_token(last) || last == ')' || last == ']' || last == '"' || last == '\'')) {
+                return false;
+            }
+
+            groups.push_back(c == '(' ? ')' : ']');
+            ++index;
+        } else if(c == ')' || (c == ']' && allowShared)) {
+            if(groups.empty() || groups.back() != c) {
+                return false;
+            }
+
+            groups.pop_back();
+            ++index;
+        } else if(c != '\0' && strchr(operators, c) != nullptr) {
+            ++index;
+        } else {
+            return false;
+        }
+
+        last = script.data[index - 1];
+    }
+
+    return hasValue && groups.empty();
+}
+
+// Whether the token at the given position is an object key (e.g. { REGION: 1 }).
+static bool is_object_key(const ConstBuffer& script, size_t tokenStart, size_t tokenEnd) {
+    while(tokenEnd < script.size && str::is_blank(script.data[tokenEnd])) {
+        ++tokenEnd;
+    }
+
+    if(tokenEnd >= script.size || script.data[tokenEnd] != ':') {
+        return false;
+    }
+
+    while(tokenStart > 0 && str::is_blank(script.data[tokenStart - 1])) {
+        --tokenStart;
+    }
+
+    return tokenStart > 0 && (script.data[tokenStart - 1] == '{' || script.data[tokenStart - 1] == ',');
+}
+
+// Whether the script only reads the context and local objects (and literals), without calls or assignments.
+// Such scripts have no side effects, so a component made of them always renders the same way for the same context.
+// Unlike is_constant, property access, brackets and object literals are allowed, but the shared object isn't
+// (it can be changed by other templates between two renders of the component).
+static bool is_pure_script(const ConstBuffer& script) {
+    static const char* const roots[]   = { "context", "local", "true", "false", "null", "undefined", "NaN", "Infinity" };
+    static const char* const operators = "+-*/%!~^&|<>?:,";
+    static const char* const numeric   = "0123456789abcdefABCDEFxXoObBn_.";
+
+    size_t index = 0;
+
+    std::vector<uint8_t> groups;
+
+    uint8_t last = 0;
+
+    while(index < script.size) {
+        uint8_t c = script.data[index];
+
+        if(str::is_blank(c)) {
+            ++index;
+            continue;
+        }
+
+        if(c == '"' || c == '\'') {
+            ++index;
+
+            while(index < script.size && script.data[index] != c && script.data[index] != '\n') {
+                index += (script.data[index] == '\\') ? 2 : 1;
+            }
+
+            if(index >= script.size || script.data[index] != c) {
+                return false;
+            }
+
+            ++index;
+        } else if((c >= '0' && c <= '9') || (c == '.' && index + 1 < script.size && script.data[index + 1] >= '0' && script.data[index + 1] <= '9')) {
+            while(index < script.size && script.data[index] != '\0' && strchr(numeric, script.data[index]) != nullptr) {
+                ++index;
+            }
+
+            if(index < script.size && str::valid_in_token(script.data[index])) {
+                return false;
+            }
+        } else if(str::valid_in_token(c)) {
+            size_t tokenStart = index;
+
+            while(index < script.size && str::valid_in_token(script.data[index])) {
+                ++index;
+            }
+
+            // Property names and object keys can be anything, but other identifiers must be one of the roots.
+            bool valid = (last == '.') || is_object_key(script, tokenStart, index);
+
+            for(auto root : roots) {
+                if(!valid && index - tokenStart == strlen(root) && mem::cmp(script.data + tokenStart, root, index - tokenStart)) {
+                    valid = true;
+                }
+            }
+
+            if(!valid) {
+                return false;
+            }
+        } else if(c == '.') {
+            ++index;
+        } else if(c == '(' || c == '[' || c == '{') {
+            // A parenthesis after a value is a call.
+            if(c == '(' && (str::valid_in_token(last) || last == ')' || last == ']' || last == '"' || last == '\'')) {
+                return false;
+            }
+
+            groups.push_back(c == '(' ? ')' : (c == '[' ? ']' : '}'));
+            ++index;
+        } else if(c == ')' || c == ']' || c == '}') {
+            if(groups.empty() || groups.back() != c) {
+                return false;
+            }
+
+            groups.pop_back();
+            ++index;
+        } else if(c == '=') {
+            uint8_t previous = index > 0 ? script.data[index - 1] : 0;
+            uint8_t next     = index + 1 < script.size ? script.data[index + 1] : 0;
+
+            // Only comparisons (==, ===, !=, !==, <=, >=), not assignments (=, +=, <<=, etc) or arrow functions.
+            if(next == '=') {
+                while(index < script.size && script.data[index] == '=') {
+                    ++index;
+                }
+            } else if(next != '>' && (previous == '!' || ((previous == '<' || previous == '>') && (index < 2 || script.data[index - 2] != previous)))) {
+                ++index;
+            } else {
+                return false;
+            }
+        } else if(c != '\0' && strchr(operators, c) != nullptr) {
+            // Increments and decrements.
+            if((c == '+' || c == '-') && index + 1 < script.size && script.data[index + 1] == c) {
+                return false;
+            }
+
+            ++index;
+        } else {
+            return false;
+        }
+
+        last = script.data[index - 1];
+    }
+
+    return groups.empty();
+}
+
+static bool is_pure(const std::vector<OshNode>& nodes) {
+    for(const auto& node : nodes) {
+        switch(node.marker) {
+            case *OSH_PLAINTEXT:
+                break;
+            case *OSH_TEMPLATE:
+                if(!is_content_marker(node) && !is_pure_script(node.value)) {
+                    return false;
+                }
+                break;
+            case *OSH_TEMPLATE_CONDITIONAL_START:
+                for(const auto& branch : node.branches) {
+                    if((!branch.isElse && !is_pure_script(branch.condition)) || !is_pure(branch.body)) {
+                        return false;
+                    }
+                }
+                break;
+            case *OSH_TEMPLATE_LOOP_START:
+            case *OSH_TEMPLATE_LOOP_REVERSE_START:
+            case *OSH_TEMPLATE_COMPONENT:
+                // The loop iterator is assigned to the local object of the component, which is new for every render of it.
+                if((node.extra.size > 0 && !is_pure_script(node.extra)) || !is_pure(node.body)) {
+                    return false;
+                }
+                break;
+            default:
+                return false; // Void templates.
+        }
+    }
+
+    return true;
+}
+
+static size_t skip_blanks(const ConstBuffer& script, size_t index) {
+    while(index < script.size && str::is_blank(script.data[index])) {
+        ++index;
+    }
+
+    return index;
+}
+
+// Returns the index right after the last non-blank character before 'index' (0 if there is none).
+static size_t skip_blanks_back(const ConstBuffer& script, size_t index) {
+    while(index > 0 && str::is_blank(script.data[index - 1])) {
+        --index;
+    }
+
+    return index;
+}
+
+static bool is_keyword(const ConstBuffer& token, const char* keyword) {
+    return token.size == strlen(keyword) && mem::cmp(token.data, keyword, token.size);
+}
+
+// Returns the token that ends right before 'end' (blanks skipped), or an empty buffer.
+static ConstBuffer previous_token(const ConstBuffer& script, size_t end) {
+    end = skip_blanks_back(script, end);
+
+    size_t start = end;
+
+    while(start > 0 && str::valid_in_token(script.data[start - 1])) {
+        --start;
+    }
+
+    return ConstBuffer(script.data + start, end - start);
+}
+
+// Returns the index of the bracket that closes the one at 'open' (strings skipped), or the size of the script.
+static size_t find_closing(const ConstBuffer& script, size_t open) {
+    std::vector<uint8_t> groups;
+
+    for(size_t index = open; index < script.size; ++index) {
+        uint8_t c = script.data[index];
+
+        if(c == '"' || c == '\'' || c == '`') {
+            ++index;
+
+            while(index < script.size && script.data[index] != c) {
+                index += (script.data[index] == '\\') ? 2 : 1;
+            }
+        } else if(c == '(' || c == '[' || c == '{') {
+            groups.push_back(c);
+        } else if(c == ')' || c == ']' || c == '}') {
+            groups.pop_back();
+
+            if(groups.empty()) {
+                return index;
+            }
+        }
+    }
+
+    return script.size;
+}
+
+// Whether the parenthesis at 'open' starts a parameter list (arrow functions, functions, methods and catch clauses).
+static bool is_parameter_list(const ConstBuffer& script, size_t open) {
+    size_t after = skip_blanks(script, find_closing(script, open) + 1);
+
+    if(after + 1 < script.size && script.data[after] == '=' && script.data[after + 1] == '>') {
+        return true;
+    }
+
+    ConstBuffer token = previous_token(script, open);
+
+    if(is_keyword(token, "function") || is_keyword(token, "catch")) {
+        return true;
+    }
+
+    // Named functions (function name(...)), and methods ({ name(...) { } }).
+    if(token.size > 0 && is_keyword(previous_token(script, token.data - script.data), "function")) {
+        return true;
+    }
+
+    return after < script.size && script.data[after] == '{' && token.size > 0 && !is_keyword(token, "if") && !is_keyword(token, "for") &&
+           !is_keyword(token, "while") && !is_keyword(token, "switch") && !is_keyword(token, "with");
+}
+
+// Whether the token declares a variable or a parameter with its name (e.g. REGION => REGION * 2), which then hides the define.
+// 'groups' holds the positions of the brackets that are open at the token.
+static bool is_binding(const ConstBuffer& script, size_t tokenStart, size_t tokenEnd, const std::vector<size_t>& groups) {
+    size_t after = skip_blanks(script, tokenEnd);
+
+    if(after + 1 < script.size && script.data[after] == '=' && script.data[after + 1] == '>') {
+        return true;
+    }
+
+    ConstBuffer token = previous_token(script, tokenStart);
+
+    if(is_keyword(token, "let") || is_keyword(token, "const") || is_keyword(token, "var") || is_keyword(token, "function") || is_keyword(token, "class")) {
+        return true;
+    }
+
+    for(auto open : groups) {
+        if(script.data[open] == '(' && is_parameter_list(script, open)) {
+            return true;
+        }
+
+        // Destructuring assignments (e.g. ({ REGION } = value)).
+        if(script.data[open] != '(') {
+            size_t close = skip_blanks(script, find_closing(script, open) + 1);
+
+            if(close < script.size && script.data[close] == '=' && (close + 1 >= script.size || (script.data[close + 1] != '=' && script.data[close + 1] != '>'))) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Whether the token is a shorthand property (e.g. { REGION }), which must keep its name when substituted.
+static bool is_shorthand_property(const ConstBuffer& script, size_t tokenStart, size_t tokenEnd, const std::vector<size_t>& groups) {
+    if(groups.empty() || script.data[groups.back()] != '{') {
+        return false;
+    }
+
+    size_t before = skip_blanks_back(script, tokenStart);
+    size_t after  = skip_blanks(script, tokenEnd);
+
+    return before > 0 && (script.data[before - 1] == '{' || script.data[before - 1] == ',') &&
+           after < script.size && (script.data[after] == '}' || script.data[after] == ',');
+}
+
+// Whether the slash at 'index' starts a regex literal (e.g. /REGION/.test(value)) instead of being a division.
+// It does when there is no operand before it (nothing, an operator, an open bracket or a keyword like 'return').
+static bool is_regex_start(const ConstBuffer& script, size_t index) {
+    if(index + 1 < script.size && (script.data[index + 1] == '/' || script.data[index + 1] == '*')) {
+        return false; // Comments.
+    }
+
+    size_t before = skip_blanks_back(script, index);
+
+    if(before == 0) {
+        return true;
+    }
+
+    uint8_t last = script.data[before - 1];
+
+    if(last == ')' || last == ']' || last == '"' || last == '\'' || last == '`') {
+        return false;
+    }
+
+    if(str::valid_in_token(last)) {
+        ConstBuffer token = previous_token(script, before);
+
+        return is_keyword(token, "return") || is_keyword(token, "typeof") || is_keyword(token, "case") || is_keyword(token, "in") ||
+               is_keyword(token, "of") || is_keyword(token, "delete") || is_keyword(token, "void") || is_keyword(token, "new") ||
+               is_keyword(token, "instanceof") || is_keyword(token, "yield") || is_keyword(token, "await") || is_keyword(token, "else") ||
+               is_keyword(token, "do");
+    }
+
+    return true;
+}
+
+// Returns the index right after the regex literal that starts at 'index' (including its flags).
+static size_t skip_regex(const ConstBuffer& script, size_t index) {
+    bool inClass = false; // Slashes inside a character class (e.g. /[/]/) don't end the regex.
+
+    for(++index; index < script.size && script.data[index] != '\n'; ++index) {
+        uint8_t c = script.data[index];
+
+        if(c == '\\') {
+            ++index;
+        } else if(c == '[') {
+            inClass = true;
+        } else if(c == ']') {
+            inClass = false;
+        } else if(c == '/' && !inClass) {
+            ++index;
+            break;
+        }
+    }
+
+    while(index < script.size && str::valid_in_token(script.data[index])) {
+        ++index;
+    }
+
+    return std::min(index, script.size);
+}
+
+// Replaces the defines in the script by their values. Void templates are statements that may declare variables
+// with the same names, so 'onlyConstant' is used for them; the script is then only changed if it becomes constant.
+// The same goes for scripts that declare a parameter or a variable with the name of a define.
+ConstBuffer Optimizer::substitute_defines(ConstBuffer script, bool onlyConstant) {
+    if(opts.defines.empty()) {
+        return script;
+    }
+
+    std::string result;
+    bool substituted = false;
+
+    // The positions of the open brackets.
+    std::vector<size_t> groups;
+
+    size_t index = 0;
+
+    while(index < script.size) {
+        uint8_t c = script.data[index];
+
+        if(c == '"' || c == '\'') {
+            size_t stringStart = index++;
+
+            while(index < script.size && script.data[index] != c && script.data[index] != '\n') {
+                index += (script.data[index] == '\\') ? 2 : 1;
+            }
+
+            index = std::min(index + 1, script.size);
+            result.append(reinterpret_cast<const char*>(script.data + stringStart), index - stringStart);
+        } else if(str::valid_in_token(c)) {
+            size_t tokenStart = index;
+
+            while(index < script.size && str::valid_in_token(script.data[index])) {
+                ++index;
+            }
+
+            std::string token(reinterpret_cast<const char*>(script.data + tokenStart), index - tokenStart);
+            auto define = opts.defines.find(token);
+
+            // Property access (e.g. context.REGION) is not a define.
+            if(define == opts.defines.end() || (tokenStart > 0 && script.data[tokenStart - 1] == '.') || is_object_key(script, tokenStart, index)) {
+                result += token;
+            } else if(is_binding(script, tokenStart, index, groups)) {
+                result += token;
+                onlyConstant = true;
+            } else {
+                if(is_shorthand_property(script, tokenStart, index, groups)) {
+                    result += token + ": ";
+                }
+
+                result += '(' + define->second + ')';
+                substituted = true;
+            }
+        } else if(c == '`') {
+            // Template strings can contain scripts, which are not handled here.
+            return script;
+        } else if(c == '/' && is_regex_start(script, index)) {
+            size_t regexStart = index;
+
+            index = skip_regex(script, index);
+            result.append(reinterpret_cast<const char*>(script.data + regexStart), index - regexStart);
+        } else {
+            if(c == '(' || c == '[' || c == '{') {
+                groups.push_back(index);
+            } else if((c == ')' || c == ']' || c == '}') && !groups.empty()) {
+                groups.pop_back();
+            }
+
+            result += (char) c;
+            ++index;
+        }
+    }
+
+    if(!substituted || (onlyConstant && !is_constant(ConstBuffer(result.data(), result.size()), false))) {
+        return script;
+    }
+
+    storage.push_back(std::move(result));
+    return ConstBuffer(storage.back().data(), storage.back().size());
+}
+
+// Evaluates the constant templates, and removes the conditional branches that can't be reached.
+void Optimizer::fold_constants(std::vector<OshNode>& nodes) {
+    std::vector<OshNode> result;
+    result.reserve(nodes.size());
+
+    for(auto& node : nodes) {
+        switch(node.marker) {
+            case *OSH_TEMPLATE: {
+                if(is_content_marker(node)) {
+                    break;
+                }
+
+                node.value = substitute_defines(node.value, false);
+
+                if(!is_constant(node.value, !shared.IsEmpty())) {
+                    break;
+                }
+
+                Buffer folded;
+
+                if(!Eryn::NormalBridge::eval_constant_template(bridge, node.value, folded, shared)) {
+                    break;
+                }
+
+                LOG_DEBUG("Folded template '%.*s'", (int) node.value.size, node.value.data);
+
+                storage.emplace_back(reinterpret_cast<const char*>(folded.data), folded.size);
+                result.emplace_back(*OSH_PLAINTEXT, ConstBuffer(storage.back().data(), storage.back().size()));
+                continue;
+            }
+            case *OSH_TEMPLATE_VOID: {
+                Buffer discarded;
+
+                node.value = substitute_defines(node.value, true);
+
+                // Constant scripts have no side effects. If the script throws, keep it so the error is reported when rendering.
+                if(is_constant(node.value, !shared.IsEmpty()) && Eryn::NormalBridge::eval_constant_template(bridge, node.value, discarded, shared)) {
+                    continue;
+                }
+                break;
+            }
+            case *OSH_TEMPLATE_CONDITIONAL_START: {
+                std::vector<OshBranch> branches;
+
+                for(auto& branch : node.branches) {
+                    bool value;
+
+                    if(!branch.isElse) {
+                        branch.condition = substitute_defines(branch.condition, false);
+                    }
+
+                    if(!branch.isElse && is_constant(branch.condition, !shared.IsEmpty()) &&
+                       Eryn::NormalBridge::eval_constant_conditional(bridge, branch.condition, value, shared)) {
+                        LOG_DEBUG("Folded condition '%.*s'", (int) branch.condition.size, branch.condition.data);
+
+                        if(!value) {
+                            continue;
+                        }
+
+                        // The branches after this one can't be reached, so this one works like an else.
+                        branch.isElse    = true;
+                        branch.condition = ConstBuffer(nullptr, 0);
+                    }
+
+                    bool last = branch.isElse;
+
+                    fold_constants(branch.body);
+                    branches.push_back(std::move(branch));
+
+                    if(last) {
+                        break;
+                    }
+                }
+
+                // All the conditions are false.
+                if(branches.empty()) {
+                    continue;
+                }
+
+                // The first reachable branch is always rendered.
+                if(branches[0].isElse) {
+                    for(auto& bodyNode : branches[0].body) {
+                        result.push_back(std::move(bodyNode));
+                    }
+
+                    continue;
+                }
+
+                node.branches = std::move(branches);
+                break;
+            }
+            case *OSH_TEMPLATE_LOOP_START:
+            case *OSH_TEMPLATE_LOOP_REVERSE_START:
+            case *OSH_TEMPLATE_COMPONENT:
+                // The loop iterable, or the component context.
+                node.extra = substitute_defines(node.extra, false);
+
+                fold_constants(node.body);
+                break;
+        }
+
+        result.push_back(std::move(node));
+    }
+
+    nodes = std::move(result);
+}
+
+// Moves the plaintext that every branch of a conditional starts (or ends) with before (or after) the conditional.
+// This only works when the conditional has an else branch, because otherwise the text isn't always rendered.
+static void hoist_plaintext(OshNode& conditional, std::vector<OshNode>& before, std::vector<OshNode>& after) {
+    if(!conditional.branches.back().isElse) {
+        return;
+    }
+
+    auto& branches = conditional.branches;
+
+    auto commonLength = [&branches](bool fromStart) -> size_t {
+        size_t length = SIZE_MAX;
+
+        for(const auto& branch : branches) {
+            if(branch.body.empty()) {
+                return 0;
+            }
+
+            auto& node  = fromStart ? branch.body.front() : branch.body.back();
+            auto& first = fromStart ? branches[0].body.front().value : branches[0].body.back().value;
+
+            if(node.marker != *OSH_PLAINTEXT) {
+                return 0;
+            }
+
+            size_t matching = 0;
+            size_t limit    = std::min(length, std::min(node.value.size, first.size));
+
+            if(fromStart) {
+                while(matching < limit && node.value.data[matching] == first.data[matching]) {
+                    ++matching;
+                }
+            } else {
+                while(matching < limit && node.value.end()[-1 - (ptrdiff_t) matching] == first.end()[-1 - (ptrdiff_t) matching]) {
+                    ++matching;
+                }
+            }
+
+            length = matching;
+        }
+
+        return length;
+    };
+
+    size_t prefix = commonLength(true);
+
+    if(prefix > 0) {
+        before.emplace_back(*OSH_PLAINTEXT, ConstBuffer(branches[0].body.front().value.data, prefix));
+
+        for(auto& branch : branches) {
+            auto& value = branch.body.front().value;
+            value = ConstBuffer(value.data + prefix, value.size - prefix);
+
+            if(value.size == 0) {
+                branch.body.erase(branch.body.begin());
+            }
+        }
+    }
+
+    size_t suffix = commonLength(false);
+
+    if(suffix > 0) {
+        after.emplace_back(*OSH_PLAINTEXT, ConstBuffer(branches[0].body.back().value.end() - suffix, suffix));
+
+        for(auto& branch : branches) {
+            auto& value = branch.body.back().value;
+            value = ConstBuffer(value.data, value.size - suffix);
+
+            if(value.size == 0) {
+                branch.body.pop_back();
+            }
+        }
+    }
+}
+
+// Merges adjacent plaintext and removes empty plaintext, so the renderer does fewer (and bigger) writes.
+void Optimizer::merge_plaintext(std::vector<OshNode>& nodes) {
+    std::vector<OshNode> result;
+    result.reserve(nodes.size());
+
+    // Adjacent plaintext nodes are collected here, and written as a single node when the run ends.
+    std::vector<ConstBuffer> run;
+
+    auto flush = [this, &result, &run]() {
+        if(run.size() == 1) {
+            result.emplace_back(*OSH_PLAINTEXT, run[0]);
+        } else if(run.size() > 1) {
+            storage.emplace_back();
+
+            for(const auto& value : run) {
+                storage.back().append(reinterpret_cast<const char*>(value.data), value.size);
+            }
+
+            result.emplace_back(*OSH_PLAINTEXT, ConstBuffer(storage.back().data(), storage.back().size()));
+        }
+
+        run.clear();
+    };
+
+    for(auto& node : nodes) {
+        std::vector<OshNode> after;
+
+        switch(node.marker) {
+            case *OSH_PLAINTEXT:
+                if(node.value.size > 0) {
+                    run.push_back(node.value);
+                }
+                continue;
+            case *OSH_TEMPLATE_CONDITIONAL_START: {
+                for(auto& branch : node.branches) {
+                    merge_plaintext(branch.body);
+                }
+
+                std::vector<OshNode> before;
+                hoist_plaintext(node, before, after);
+
+                for(auto& hoisted : before) {
+                    run.push_back(hoisted.value);
+                }
+
+                break;
+            }
+            case *OSH_TEMPLATE_LOOP_START:
+            case *OSH_TEMPLATE_LOOP_REVERSE_START:
+            case *OSH_TEMPLATE_COMPONENT:
+                merge_plaintext(node.body);
+                break;
+        }
+
+        flush();
+        result.push_back(std::move(node));
+
+        for(auto& hoisted : after) {
+            run.push_back(hoisted.value);
+        }
+    }
+
+    flush();
+    nodes = std::move(result);
+}
+
+bool Eryn::is_side_effect_free(ConstBuffer osh) {
+    try {
+        return is_pure(parse_osh(osh));
+    } catch(InternalException&) {
+        return false;
+    }
+}
+
+// 'isFile' is false for strings, which can't be compiled again when a dependency changes.
+ConstBuffer Eryn::Engine::optimize(BridgeCompileData bridge, ConstBuffer osh, const char* path, bool isFile) {
+    bool inlining = opts.flags.inlineStaticComponents && isFile && !opts.flags.bypassCache;
+    bool merging  = opts.flags.mergePlaintext;
+    bool folding  = (opts.flags.foldConstants || !opts.defines.empty()) && opts.mode == EngineMode::NORMAL;
+
+    if(isFile) {
+        cache.untrack(path);
+    }
+
+    if(!inlining && !merging && !folding) {
+        return osh;
+    }
+
+    LOG_DEBUG("===> Optimizing '%s'", path);
+
+    Optimizer optimizer(*this, bridge, path);
+    auto nodes = parse_osh(osh);
+
+    if(inlining) {
+        optimizer.inline_components(nodes);
+    }
+
+    if(folding) {
+        optimizer.fold_constants(nodes);
+    }
+
+    if(merging) {
+        optimizer.merge_plaintext(nodes);
+    }
+
+    Buffer output;
+    emit_nodes(nodes, output);
+
+    // The nodes may point inside the old OSH, so it can only be released after emitting.
+    ConstBuffer::finalize(osh);
+
+    LOG_DEBUG("===> Done\n");
+
+    return output.finalize();
+}
+
+// Creates a variant of the OSH in which the reads of the frozen shared object are evaluated,
+// so the templates that only depend on it become plaintext, and the conditionals on it are pruned.
+ConstBuffer& Eryn::Engine::specialize(BridgeCompileData bridge, BridgeShared shared, const char* path) {
+    if(specialized.has(path)) {
+        return specialized.get(path);
+    }
+
+    LOG_DEBUG("===> Specializing '%s'", path);
+
+    Optimizer optimizer(*this, bridge, path);
+    optimizer.shared = shared;
+
+    auto nodes = parse_osh(cache.get(path));
+
+    optimizer.fold_constants(nodes);
+
+    if(opts.flags.mergePlaintext) {
+        optimizer.merge_plaintext(nodes);
+    }
+
+    Buffer output;
+    emit_nodes(nodes, output);
+
+    specialized.add(path, output.finalize());
+
+    LOG_DEBUG("===> Done\n");
+
+    return specialized.get(path);
+}
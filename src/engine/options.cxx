@@ -11,9 +11,17 @@ Eryn::Options::Options() {
     flags.cloneBackups           = false;
     flags.cloneLocalInLoops      = false;
     flags.debugDumpOSH           = false;
+    flags.inlineStaticComponents = false;
+    flags.mergePlaintext         = false;
+    flags.foldConstants          = false;
+    flags.minifyHTML             = false;
+    flags.batchCompileHook       = false;
+    flags.memoizeCompileHook     = false;
+    flags.memoizeComponents      = false;
 
-    mode       = Eryn::EngineMode::NORMAL;
-    workingDir = ".";
+    mode            = Eryn::EngineMode::NORMAL;
+    workingDir      = ".";
+    inlineThreshold = 4096;
 
     templates.escape               = '\\';
     templates.start                = "[|";
@@ -0,0 +1,91 @@
+#include "engine.hxx"
+
+#include "../def/os.dxx"
+#include "../def/logging.dxx"
+
+#ifdef OS_WINDOWS
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <dlfcn.h>
+#endif
+
+static void write_to_buffer(void* target, const uint8_t* data, size_t size) {
+    if(size > 0) {
+        static_cast<Buffer*>(target)->write(data, size);
+    }
+}
+
+std::shared_ptr<Eryn::HookPlugin> Eryn::HookPlugin::load(const string& path, string& error) {
+#ifdef OS_WINDOWS
+    HMODULE handle = LoadLibraryA(path.c_str());
+
+    if(handle == nullptr) {
+        error = "cannot load library '" + path + "' (error " + std::to_string(GetLastError()) + ")";
+        return nullptr;
+    }
+
+    auto transform = reinterpret_cast<eryn_transform_fn>(GetProcAddress(handle, ERYN_PLUGIN_TRANSFORM_SYMBOL));
+
+    if(transform == nullptr) {
+        FreeLibrary(handle);
+
+        error = "library '" + path + "' doesn't export '" ERYN_PLUGIN_TRANSFORM_SYMBOL "'";
+        return nullptr;
+    }
+#else
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+    if(handle == nullptr) {
+        const char* reason = dlerror();
+
+        error = reason != nullptr ? reason : "cannot load library '" + path + "'";
+        return nullptr;
+    }
+
+    auto transform = reinterpret_cast<eryn_transform_fn>(dlsym(handle, ERYN_PLUGIN_TRANSFORM_SYMBOL));
+
+    if(transform == nullptr) {
+        dlclose(handle);
+
+        error = "library '" + path + "' doesn't export '" ERYN_PLUGIN_TRANSFORM_SYMBOL "'";
+        return nullptr;
+    }
+#endif
+
+    LOG_DEBUG("Loaded compile hook plugin '%s'", path.c_str());
+
+    return std::shared_ptr<HookPlugin>(new HookPlugin(handle, transform, path));
+}
+
+Eryn::HookPlugin::HookPlugin(void* handle, eryn_transform_fn transform, const string& path) : handle(handle), transform(transform), path(path) { }
+
+Eryn::HookPlugin::~HookPlugin() {
+    LOG_DEBUG("Unloading compile hook plugin '%s'", path.c_str());
+
+#ifdef OS_WINDOWS
+    FreeLibrary(static_cast<HMODULE>(handle));
+#else
+    dlclose(handle);
+#endif
+}
+
+bool Eryn::HookPlugin::call(Buffer& buffer, const char* origin) const {
+    Buffer      result;
+    eryn_writer writer{ &result, write_to_buffer };
+
+    int status = transform(origin, buffer.data, buffer.size, &writer);
+
+    if(status == ERYN_TRANSFORM_KEEP) {
+        return true;
+    }
+    if(status != ERYN_TRANSFORM_REPLACE) {
+        return false;
+    }
+
+    buffer.clear();
+    buffer.write(result.data, result.size);
+
+    return true;
+}
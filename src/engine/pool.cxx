@@ -0,0 +1,132 @@
+#include <algorithm>
+
+#include "engine.hxx"
+
+#include "../../lib/remem.hxx"
+
+// Outputs are pooled in power-of-two classes from 2^OUTPUT_POOL_MIN_CLASS to 2^OUTPUT_POOL_MAX_CLASS bytes.
+// Smaller outputs are cheap to allocate, and larger ones are rare enough that keeping them isn't worth the memory.
+// JS buffers are collected in batches (a GC can finalize thousands at once), so each class keeps up to
+// OUTPUT_POOL_CLASS_BYTES of blocks (but at least OUTPUT_POOL_CLASS_BLOCKS), and the pool up to OUTPUT_POOL_MAX_BYTES.
+static constexpr size_t OUTPUT_POOL_MIN_CLASS    = 8;  // 256 bytes
+static constexpr size_t OUTPUT_POOL_MAX_CLASS    = 20; // 1 MB
+static constexpr size_t OUTPUT_POOL_CLASS_BYTES  = 4 * 1024 * 1024;
+static constexpr size_t OUTPUT_POOL_CLASS_BLOCKS = 8;
+static constexpr size_t OUTPUT_POOL_MAX_BYTES    = 32 * 1024 * 1024;
+
+// The class of the smallest blocks that can hold 'size' bytes.
+static size_t class_above(size_t size) {
+    size_t index = OUTPUT_POOL_MIN_CLASS;
+
+    while((static_cast<size_t>(1) << index) < size) {
+        ++index;
+    }
+
+    return index;
+}
+
+// The class of the largest blocks that fit in 'capacity' bytes.
+static size_t class_below(size_t capacity) {
+    size_t index = OUTPUT_POOL_MIN_CLASS;
+
+    while(index < OUTPUT_POOL_MAX_CLASS && (static_cast<size_t>(1) << (index + 1)) <= capacity) {
+        ++index;
+    }
+
+    return index;
+}
+
+Eryn::OutputPool::OutputPool() : classes(OUTPUT_POOL_MAX_CLASS - OUTPUT_POOL_MIN_CLASS + 1), poolStats() {
+}
+
+Eryn::OutputPool::~OutputPool() {
+    clear();
+}
+
+Eryn::OutputPool& Eryn::OutputPool::local() {
+    static thread_local OutputPool pool;
+    return pool;
+}
+
+Buffer Eryn::OutputPool::acquire(size_t size) {
+    if(size == 0 || size > (static_cast<size_t>(1) << OUTPUT_POOL_MAX_CLASS)) {
+        Buffer buffer;
+        buffer.reserve(size);
+
+        return buffer;
+    }
+
+    auto  index  = class_above(size);
+    auto& blocks = classes[index - OUTPUT_POOL_MIN_CLASS];
+
+    if(blocks.empty()) {
+        ++poolStats.misses;
+
+        Buffer buffer;
+        buffer.reserve(static_cast<size_t>(1) << index);
+
+        return buffer;
+    }
+
+    ++poolStats.hits;
+
+    Buffer buffer(blocks.back(), 0);
+    buffer.capacity = static_cast<size_t>(1) << index;
+
+    blocks.pop_back();
+
+    --poolStats.blocks;
+    poolStats.bytes -= buffer.capacity;
+
+    return buffer;
+}
+
+void Eryn::OutputPool::release(uint8_t* data, size_t capacity) {
+    if(data == nullptr) {
+        return;
+    }
+
+    // Blocks above the largest class are freed, like acquire doesn't take them from the pool
+    // (otherwise they would be kept in the largest class, and counted as smaller than they are).
+    if(capacity >= (static_cast<size_t>(1) << OUTPUT_POOL_MIN_CLASS) && capacity <= (static_cast<size_t>(1) << OUTPUT_POOL_MAX_CLASS)) {
+        auto  index  = class_below(capacity);
+        auto  size   = static_cast<size_t>(1) << index;
+        auto& blocks = classes[index - OUTPUT_POOL_MIN_CLASS];
+
+        auto limit  = std::max(OUTPUT_POOL_CLASS_BYTES >> index, OUTPUT_POOL_CLASS_BLOCKS);
+
+        if(blocks.size() < limit && poolStats.bytes + size <= OUTPUT_POOL_MAX_BYTES) {
+            blocks.push_back(data);
+
+            ++poolStats.recycled;
+            ++poolStats.blocks;
+            poolStats.bytes += size;
+
+            return;
+        }
+    }
+
+    ++poolStats.freed;
+    REMEM_FREE(data);
+}
+
+void Eryn::OutputPool::clear() {
+    for(auto& blocks : classes) {
+        for(auto block : blocks) {
+            REMEM_FREE(block);
+        }
+
+        blocks.clear();
+    }
+
+    poolStats.blocks = 0;
+    poolStats.bytes  = 0;
+}
+
+void Eryn::OutputPool::track_external(int64_t change) {
+    poolStats.external += change;
+}
+
+const Eryn::OutputPool::Stats& Eryn::OutputPool::stats() const {
+    return poolStats;
+}
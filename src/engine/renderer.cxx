@@ -1,5 +1,8 @@
-#include <stack>
+#include <deque>
+#include <algorithm>
+#include <vector>
 #include <cstdio>
+#include <cstring>
 #include <memory>
 #include <unordered_set>
 
@@ -15,6 +18,27 @@
 #include "../../lib/mem.hxx"
 #include "../../lib/chunk.hxx"
 #include "../../lib/timer.hxx"
+#include "../../lib/arena.hxx"
+
+// The output is presized to the expected size plus 1/OUTPUT_SIZE_MARGIN of it, and is only shrunk
+// at the end if more than 1/OUTPUT_SHRINK_SLACK of it (and at least OUTPUT_MIN_SLACK bytes) is unused.
+static constexpr size_t OUTPUT_SIZE_MARGIN  = 16;
+static constexpr size_t OUTPUT_SHRINK_SLACK = 8;
+static constexpr size_t OUTPUT_MIN_SLACK    = 256;
+
+// When scattering, plaintext shorter than this is copied. Every segment becomes a JS buffer,
+// which costs about as much as copying a few KB.
+static constexpr size_t SCATTER_MIN_SEGMENT = 4096;
+
+// Memoized components (see memoizeComponents) must have a context of at most MEMO_MAX_KEY bytes (serialized),
+// and an output of at most MEMO_MAX_OUTPUT bytes. A render keeps up to MEMO_MAX_BYTES of outputs (and of keys).
+static constexpr size_t MEMO_MAX_KEY    = 1024;
+static constexpr size_t MEMO_MAX_OUTPUT = 64 * 1024;
+static constexpr size_t MEMO_MAX_BYTES  = 4 * 1024 * 1024;
+
+// Time-sliced renders only read the clock every few instructions (and renders with a deadline every few loop iterations
+// and components), since that costs more than most instructions.
+static constexpr uint32_t SLICE_CHECK_INTERVAL = 64;
 
 // Contains information about a loop, such as the iterator, the iterable, and the current index.
 struct LoopStackInfo {
@@ -30,13 +54,13 @@ struct LoopStackInfo {
     // Keys are only used for objects.
     Eryn::BridgeObjectKeys keys;
 
-    // The name of the iterator (e.g. [|@ item  : context.items |] -> 'item')
-    std::string iterator;
+    // The name of the iterator (e.g. [|@ item  : context.items |] -> 'item'). Points to the OSH.
+    ConstBuffer iterator;
     // Whether the iterable is an array or an object.
     bool isArray;
 
-    LoopStackInfo(Eryn::Bridge& bridge, ConstBuffer iterator, ConstBuffer array, int32_t step)
-        : bridge(bridge), iterator(std::string(reinterpret_cast<const char*>(iterator.data), iterator.size)), index(0), step(step) {
+    LoopStackInfo(Eryn::Bridge& bridge, Arena& arena, ConstBuffer iterator, ConstBuffer array, int32_t step)
+        : bridge(bridge), keys(ArenaAllocator<Napi::Value>(arena)), iterator(iterator), index(0), step(step) {
 
         isArray = this->bridge.initLoopIterable(array, iterable, keys);
 
@@ -75,16 +99,157 @@ struct ComponentStackInfo {
     const uint8_t* path;
     const uint8_t* context;
 
-    size_t startIndex;
+    Buffer* capture;        // Where the content is rendered.
+    Buffer* previousOutput; // Where the output goes after the content is rendered.
+
     size_t pathLength;
     size_t contextLength;
 };
 
+// Buffers in which the content of the components is captured. They are kept for the whole render,
+// so every component with content reuses the memory instead of allocating a new buffer.
+struct CapturePool {
+    std::deque<Buffer>   buffers; // A deque doesn't move the buffers when growing.
+    std::vector<Buffer*> available;
+
+    Buffer* acquire() {
+        if(available.empty()) {
+            buffers.emplace_back();
+            return &buffers.back();
+        }
+
+        auto buffer = available.back();
+        available.pop_back();
+
+        return buffer;
+    }
+
+    void release(Buffer* buffer) {
+        buffer->clear();
+        available.push_back(buffer);
+    }
+
+    // Makes all buffers available again (e.g. after a render that threw).
+    void reset() {
+        available.clear();
+
+        for(auto& buffer : buffers) {
+            buffer.clear();
+            available.push_back(&buffer);
+        }
+    }
+};
+
+// The outputs of the side-effect free components of a render, by component slot (where it's rendered from) and context.
+// Only the first context with a given hash is memoized for a slot; the others are rendered normally.
+struct ComponentMemo {
+    struct Entry {
+        const uint8_t* slot;
+        size_t         keyOffset; // In 'keys'.
+        size_t         keySize;
+        size_t         outputOffset; // In 'outputs'.
+        size_t         outputSize;
+    };
+
+    std::unordered_map<uint64_t, size_t> index; // Hash -> entry.
+    std::vector<Entry>                   entries;
+
+    Buffer keys;
+    Buffer outputs;
+    Buffer key; // The context that is being looked up.
+
+    void reset() {
+        index.clear();
+        entries.clear();
+        keys.clear();
+        outputs.clear();
+        key.clear();
+    }
+};
+
+// Memory that is kept by the engine between renders. A render takes it, and gives it back clean.
+struct Eryn::RenderScratch {
+    Arena         arena;    // The render stacks and loop keys.
+    CapturePool   captures;
+    ComponentMemo memo;
+    std::string path;     // Used for looking up components in the cache.
+    bool        busy;     // Whether a render is using it.
+
+    RenderScratch() : busy(false) { }
+};
+
+// Lends the scratch memory of the engine to a render. Renders can be nested (e.g. a template that renders
+// another file from JavaScript), in which case the nested render gets its own scratch memory.
+class ScratchLease {
+    std::unique_ptr<Eryn::RenderScratch> own;
+    Eryn::RenderScratch*                 scratch;
+
+    public:
+    ScratchLease(std::unique_ptr<Eryn::RenderScratch>& shared) {
+        if(!shared) {
+            shared.reset(new Eryn::RenderScratch());
+        }
+
+        if(shared->busy) {
+            own.reset(new Eryn::RenderScratch());
+            scratch = own.get();
+        } else {
+            scratch = shared.get();
+        }
+
+        scratch->busy = true;
+    }
+
+    ~ScratchLease() {
+        recycle();
+        scratch->busy = false;
+    }
+
+    // Cleans the scratch memory for the next render (the stacks don't give their memory back to the arena).
+    void recycle() {
+        scratch->captures.reset();
+        scratch->memo.reset();
+        scratch->arena.reset();
+    }
+
+    Eryn::RenderScratch& get() {
+        return *scratch;
+    }
+};
+
 struct ConditionalStackInfo {
     bool lastConditionalTrue; // Whether or not the last conditional was true.
     size_t lastTrueEndIndex;  // The true end index of the last conditional (used to jump over else).
 };
 
+// A component whose output is being recorded, so that it can be memoized when it ends.
+struct MemoRecord {
+    bool           active; // Cleared if a component with side effects is rendered inside it.
+    const uint8_t* slot;
+    uint64_t       hash;
+    size_t         keyOffset;
+    size_t         keySize;
+    Buffer*        output;  // The output must still be the same buffer when the component ends.
+    size_t         start;
+    size_t         flushed; // And none of it must have been given to the caller (streams).
+};
+
+// A file or component that is being rendered. Components push a frame instead of being rendered recursively,
+// so a render can stop between any two instructions and continue later (see Eryn::RenderStream).
+struct RenderFrame {
+    ConstBuffer input;
+    size_t      index;
+    ConstBuffer content;
+    ConstBuffer meta;
+
+    // Components restore the context and local objects when they end.
+    bool               isComponent;
+    Eryn::BridgeBackup contextBackup;
+    Eryn::BridgeBackup localBackup;
+    Buffer*            capture; // Where the content of the component was rendered (released when it ends).
+    MemoRecord         memo;
+};
+
 struct Renderer {
     Eryn::Engine&  engine;
     Eryn::Cache&   cache;
@@ -92,112 +257,572 @@ struct Renderer {
     Eryn::Bridge&  bridge;
 
     ConstBuffer    input;
-    Buffer&        output;
+    Buffer*        output; // Changes while capturing component content.
     ConstBuffer    content;
 
-    std::string    meta;
+    ConstBuffer    meta; // The path or alias of what is being rendered (not null-terminated).
+
+    Eryn::RenderScratch& scratch;
 
-    std::stack<LoopStackInfo>        loopStack;
-    std::stack<ComponentStackInfo>   componentStack;
-    std::stack<ConditionalStackInfo> conditionalStack;
-    std::stack<Eryn::BridgeBackup>   localStack;
+    // The stacks live in the scratch arena, so they don't allocate after the first renders.
+    // The frames share the other stacks, since components are always nested inside loops and conditionals.
+    ArenaStack<RenderFrame>          frames;
+    ArenaStack<LoopStackInfo>        loopStack;
+    ArenaStack<ComponentStackInfo>   componentStack;
+    ArenaStack<ConditionalStackInfo> conditionalStack;
+    ArenaStack<Eryn::BridgeBackup>   localStack;
 
     std::unordered_set<std::string>& recompiled;
+    CapturePool&                     captures;
 
     bool inputIsString;
+    bool frozen; // Whether the shared object is the frozen one.
+
+    Eryn::ScatterOutput* scatter; // Only set for scatter renders (in which case output is its dynamic buffer).
+
+    // The cache entries that must outlive the render, if any (scatter renders, streams).
+    std::vector<std::shared_ptr<const uint8_t>>* owners;
+
+    // Only set for chunked renders. The render stops before an instruction if 'chunkOutput' has at least 'chunkSize' bytes,
+    // and before the first instruction that isn't plaintext (so that the static beginning of the page is sent right away).
+    Buffer* chunkOutput;
+    size_t  chunkSize;
+    bool    prefixDone;
+
+    // Only set for time-sliced renders. The render stops before an instruction once 'sliceLength' microseconds
+    // have passed since 'sliceStart'.
+    uint64_t    sliceLength;
+    CHRONOMETER sliceStart;
+    uint32_t    sliceCounter;
+
+    bool stoppable; // Whether any of the above is set (so that normal renders only check one flag).
+
+    // Only set for renders with a deadline. The render is aborted once 'timeout' microseconds have passed since
+    // 'renderStart'. This is checked at loop back-edges and components, which is where long renders spend their time.
+    uint64_t    timeout;
+    CHRONOMETER renderStart;
+    uint32_t    deadlineCounter;
+
+    // The progress so far, reported if the render is aborted.
+    size_t iterations;
+    size_t components;
+    size_t flushed; // Output that was already given to the caller (streams).
+    Buffer* root;   // Where the output goes when not capturing.
 
     const BDP::Header BDP832 = BDP::Header(8, 32);
 
-    Renderer(Eryn::Engine& engine, Eryn::Bridge& bridge, ConstBuffer input, Buffer& output, std::unordered_set<std::string>& recompiled, std::string meta)
-        : engine(engine), cache(engine.cache), bridge(bridge), opts(engine.opts),
-          input(input), output(output), recompiled(recompiled), inputIsString(false),
-          content(nullptr, 0), meta(meta) { }
+    Renderer(Eryn::Engine& engine, Eryn::Bridge& bridge, ConstBuffer input, Buffer& output, std::unordered_set<std::string>& recompiled, Eryn::RenderScratch& scratch, const char* meta)
+        : engine(engine), cache(engine.cache), opts(engine.opts), bridge(bridge),
+          input(input), output(&output), content(nullptr, 0), meta(meta, strlen(meta)), scratch(scratch),
+          frames(scratch.arena), loopStack(scratch.arena), componentStack(scratch.arena), conditionalStack(scratch.arena), localStack(scratch.arena),
+          recompiled(recompiled), captures(scratch.captures), inputIsString(false), frozen(false), scatter(nullptr), owners(nullptr),
+          chunkOutput(nullptr), chunkSize(0), prefixDone(false), sliceLength(0), sliceCounter(0), stoppable(false),
+          timeout(0), deadlineCounter(0), iterations(0), components(0), flushed(0), root(&output) { }
 
-    Renderer(const Renderer& renderer)
-    : input({ nullptr, 0 }), output(renderer.output), content({ nullptr, 0 }), engine(renderer.engine),
-      cache(renderer.cache), opts(renderer.opts), bridge(renderer.bridge), recompiled(renderer.recompiled),
-      inputIsString(renderer.inputIsString) { }
+    Renderer(const Renderer&) = delete;
 
     void render();
 
+    // For renders that stop (see chunkOutput and sliceLength). start() must be called once, and then resume() until it returns true.
+    // If it returns false, the render stopped because a chunk is ready or the time slice ended.
+    void start();
+    bool resume();
+
+    // Moves the JS values of the render to the stash (or back), for renders that continue in a later native call.
+    void stash(Eryn::BridgeStash& stash);
+
   private:
     void error(const char* msg, const char* description);
     void error(const char* msg, const char* description, ConstBuffer token);
 
-    void render_component(ConstBuffer component, const Buffer& content);
+    // Compiles the component if it must be, and returns its OSH. For static components, returns the text
+    // they render to instead, and sets 'isStatic'. 'isPure' is set if the component is side-effect free.
+    ConstBuffer load_component(ConstBuffer component, bool& isStatic, bool& isPure);
+    // The caller must save the index of the current frame before entering, and start from 0 afterwards.
+    void        enter_component(ConstBuffer component, ConstBuffer osh, ConstBuffer context, Buffer* capture);
+    // Called after entering a component without content. If the component was already rendered from the same slot with
+    // the same context, its output is written again and the component is left (in which case this returns true).
+    // Otherwise, the output of the component is recorded if it can be memoized.
+    bool        memoize_component(const uint8_t* slot, ConstBuffer component, bool isPure);
+    void        leave_frame();
+
+    void write_plaintext(const uint8_t* data, size_t size);
+    bool should_stop(size_t inputIndex);
+    void check_deadline();
 };
 
-ConstBuffer Eryn::Engine::render(Eryn::Bridge& bridge, const char* path) {
+static void hold(std::vector<std::shared_ptr<const uint8_t>>& owners, std::shared_ptr<const uint8_t>&& owner) {
+    // The same components are usually rendered many times (e.g. in loops).
+    for(const auto& held : owners) {
+        if(held == owner) {
+            return;
+        }
+    }
+
+    owners.push_back(std::move(owner));
+}
+
+// Compiles the file before it's rendered, if it's not cached or if the cache is bypassed.
+static void compile_for_render(Eryn::Engine& engine, Eryn::Bridge& bridge, const char* path, std::unordered_set<std::string>& recompiled) {
+    if(engine.opts.flags.bypassCache) {
+        // Batches can render the same file many times, but it only needs to be recompiled once.
+        if(recompiled.insert(std::string(path)).second) {
+            engine.compile(bridge.to_compile_data(), path);
+        }
+    } else if(!engine.cache.has(path)) {
+        if(engine.opts.flags.throwOnMissingEntry) {
+            throw Eryn::RenderingException("Item does not exist in cache", "did you forget to compile this?", path);
+        }
+
+        engine.compile(bridge.to_compile_data(), path);
+    }
+}
+
+// Presizes the output from previous renders, so that it doesn't grow (and copy) while rendering.
+static Buffer make_output(size_t expected, size_t* capacity) {
+    auto size = expected + expected / OUTPUT_SIZE_MARGIN;
+
+    if(capacity != nullptr) {
+        return Eryn::OutputPool::local().acquire(size);
+    }
+
+    Buffer output;
+    output.reserve(size);
+
+    return output;
+}
+
+static ConstBuffer finish_output(Buffer& output, size_t* capacity) {
+    // Pooled outputs keep their whole block, since it goes back to the pool.
+    if(capacity != nullptr) {
+        *capacity = output.capacity;
+        return output.finalize(output.capacity);
+    }
+
+    // Shrinking costs a reallocation (and maybe a copy), which isn't worth it for a small slack.
+    return output.finalize(std::max(output.capacity / OUTPUT_SHRINK_SLACK, OUTPUT_MIN_SLACK));
+}
+
+ConstBuffer Eryn::Engine::render(Eryn::Bridge& bridge, const char* path, bool frozen, std::shared_ptr<const uint8_t>* owner, uint64_t timeout,
+                                 size_t* capacity) {
     LOG_DEBUG("===> Rendering '%s'", path);
 
     CHRONOMETER chrono = time_now();
 
     std::unordered_set<std::string> recompiled;
+    ScratchLease lease(scratch);
 
-    if(opts.flags.bypassCache) {
-        compile(bridge.to_compile_data(), path);
-        recompiled.insert(std::string(path));
-    } else if(!cache.has(path)) {
-        if(opts.flags.throwOnMissingEntry) {
-            throw Eryn::RenderingException("Item does not exist in cache", "did you forget to compile this?", path);
+    compile_for_render(*this, bridge, path, recompiled);
+
+    auto entry = frozen ? specialize(bridge.to_compile_data(), bridge.get_shared(), path) : cache.get(path);
+
+    if(owner != nullptr) {
+        auto& source = frozen ? specialized : cache;
+        ConstBuffer text;
+
+        // Empty entries are rendered normally, since an empty buffer can't point anywhere.
+        if(source.get_static(path, text) && text.size > 0) {
+            *owner = source.share(path);
+            return text;
+        }
+    }
+
+    Buffer output = make_output(cache.output_size(path), capacity);
+
+    Renderer renderer(*this, bridge, entry, output, recompiled, lease.get(), path);
+    renderer.frozen      = frozen;
+    renderer.timeout     = timeout;
+    renderer.renderStart = chrono;
+
+    renderer.render();
+
+    if(opts.flags.logRenderTime) {
+        LOG_INFO("Rendered in %s\n", getf_exec_time_mis(chrono).c_str());
+    }
+
+    cache.record_output_size(path, output.size);
+
+    return finish_output(output, capacity);
+}
+
+void Eryn::Engine::render_many(Eryn::Bridge& bridge, const std::vector<Eryn::BatchItem>& items, Buffer* joined, std::vector<Eryn::BatchOutput>& outputs,
+                               size_t& failed, bool shareStatic, uint64_t timeout) {
+    LOG_DEBUG("===> Rendering %zu items", items.size());
+
+    CHRONOMETER chrono = time_now();
+
+    std::unordered_set<std::string> recompiled;
+    ScratchLease lease(scratch);
+
+    outputs.reserve(items.size());
+
+    if(joined != nullptr) {
+        size_t expected = 0;
+
+        for(const auto& item : items) {
+            expected += cache.output_size(item.path);
         }
 
-        compile(bridge.to_compile_data(), path);
+        joined->reserve(expected + expected / OUTPUT_SIZE_MARGIN);
     }
 
-    Buffer output;
+    try {
+        for(const auto& item : items) {
+            auto path = item.path.c_str();
+
+            // The handles that the render creates are released before the next item.
+            Napi::HandleScope scope(bridge.to_compile_data().env);
+
+            bridge.reset(item.context, item.shared);
+            compile_for_render(*this, bridge, path, recompiled);
+
+            auto& source = item.frozen ? specialized : cache;
+            auto  entry  = item.frozen ? specialize(bridge.to_compile_data(), bridge.get_shared(), path) : cache.get(path);
+
+            BatchOutput result;
+            result.capacity = 0;
+
+            ConstBuffer text;
+
+            if(joined == nullptr && shareStatic && source.get_static(path, text) && text.size > 0) {
+                result.data  = text;
+                result.owner = source.share(path);
+
+                outputs.push_back(std::move(result));
+                continue;
+            }
+
+            Buffer  single;
+            Buffer* output = joined;
+
+            if(output == nullptr) {
+                single = make_output(cache.output_size(path), &result.capacity);
+                output = &single;
+            }
+
+            auto start = output->size;
+
+            Renderer renderer(*this, bridge, entry, *output, recompiled, lease.get(), path);
+            renderer.frozen      = item.frozen;
+            renderer.timeout     = timeout;
+            renderer.renderStart = chrono;
+
+            renderer.render();
+
+            cache.record_output_size(path, output->size - start);
+
+            // Joined outputs only need their size (they follow each other).
+            result.data = joined != nullptr ? ConstBuffer(nullptr, output->size - start) : finish_output(single, &result.capacity);
+
+            outputs.push_back(std::move(result));
+            lease.recycle();
+        }
+    } catch(...) {
+        failed = outputs.size();
+
+        for(auto& output : outputs) {
+            if(!output.owner && output.data.data != nullptr) {
+                OutputPool::local().release(const_cast<uint8_t*>(output.data.data), output.capacity);
+            }
+        }
+
+        outputs.clear();
+        throw;
+    }
 
-    auto entry = cache.get(path);
+    if(opts.flags.logRenderTime) {
+        LOG_INFO("Rendered %zu items in %s\n", items.size(), getf_exec_time_mis(chrono).c_str());
+    }
+}
+
+size_t Eryn::Engine::render_into(Eryn::Bridge& bridge, const char* path, uint8_t* target, size_t capacity, Buffer& overflow, bool frozen, uint64_t timeout) {
+    LOG_DEBUG("===> Rendering '%s' (into %zu bytes)", path, capacity);
+
+    CHRONOMETER chrono = time_now();
+
+    std::unordered_set<std::string> recompiled;
+    ScratchLease lease(scratch);
+
+    compile_for_render(*this, bridge, path, recompiled);
+
+    auto& source = frozen ? specialized : cache;
+    auto  entry  = frozen ? specialize(bridge.to_compile_data(), bridge.get_shared(), path) : cache.get(path);
+
+    ConstBuffer text;
+
+    if(source.get_static(path, text)) {
+        auto written = std::min(text.size, capacity);
+
+        if(written > 0) {
+            memcpy(target, text.data, written);
+        }
+
+        if(written < text.size) {
+            overflow.write(text.data + written, text.size - written);
+        }
+
+        return text.size;
+    }
+
+    // Writes directly to the target. If it's too small, the output moves to memory of its own when it fills up.
+    Buffer output = Buffer::borrow(target, capacity);
+
+    Renderer renderer(*this, bridge, entry, output, recompiled, lease.get(), path);
+    renderer.frozen      = frozen;
+    renderer.timeout     = timeout;
+    renderer.renderStart = chrono;
 
-    Renderer renderer(*this, bridge, entry, output, recompiled, path);
     renderer.render();
 
     if(opts.flags.logRenderTime) {
         LOG_INFO("Rendered in %s\n", getf_exec_time_mis(chrono).c_str());
     }
 
-    return output.finalize();
+    auto size = output.size;
+
+    if(!output.borrowed) {
+        // Fill the target, and keep the rest (moved to the start, so that the memory can be given to the caller).
+        memcpy(target, output.data, capacity);
+        memmove(output.data, output.data + capacity, size - capacity);
+
+        output.size = size - capacity;
+        overflow    = std::move(output);
+    }
+
+    return size;
 }
 
-ConstBuffer Eryn::Engine::render_string(Eryn::Bridge& bridge, const char* alias) {
+ConstBuffer Eryn::Engine::render_string(Eryn::Bridge& bridge, const char* alias, bool frozen, std::shared_ptr<const uint8_t>* owner, uint64_t timeout,
+                                        size_t* capacity) {
     LOG_DEBUG("===> Rendering '%s'", alias);
 
     CHRONOMETER chrono = time_now();
 
     std::unordered_set<std::string> recompiled;
+    ScratchLease lease(scratch);
 
     if(!cache.has(alias)) {
         throw Eryn::RenderingException("Item does not exist in cache", "did you forget to compile this?", alias);
     }
 
-    Buffer output;
+    auto entry = frozen ? specialize(bridge.to_compile_data(), bridge.get_shared(), alias) : cache.get(alias);
 
-    auto entry = cache.get(alias);
+    if(owner != nullptr) {
+        auto& source = frozen ? specialized : cache;
+        ConstBuffer text;
 
-    Renderer renderer(*this, bridge, entry, output, recompiled, alias);
+        // Empty entries are rendered normally, since an empty buffer can't point anywhere.
+        if(source.get_static(alias, text) && text.size > 0) {
+            *owner = source.share(alias);
+            return text;
+        }
+    }
+
+    Buffer output = make_output(cache.output_size(alias), capacity);
+
+    Renderer renderer(*this, bridge, entry, output, recompiled, lease.get(), alias);
     renderer.inputIsString = true;
+    renderer.frozen        = frozen;
+    renderer.timeout       = timeout;
+    renderer.renderStart   = chrono;
+
+    renderer.render();
+
+    if(opts.flags.logRenderTime) {
+        LOG_INFO("Rendered in %s\n", getf_exec_time_mis(chrono).c_str());
+    }
+
+    cache.record_output_size(alias, output.size);
+
+    return finish_output(output, capacity);
+}
+
+void Eryn::Engine::render_scatter(Eryn::Bridge& bridge, const char* path, Eryn::ScatterOutput& output, bool frozen, uint64_t timeout) {
+    LOG_DEBUG("===> Rendering '%s' (scatter)", path);
+
+    CHRONOMETER chrono = time_now();
+
+    std::unordered_set<std::string> recompiled;
+    ScratchLease lease(scratch);
+
+    compile_for_render(*this, bridge, path, recompiled);
+
+    auto entry = frozen ? specialize(bridge.to_compile_data(), bridge.get_shared(), path) : cache.get(path);
+    output.hold((frozen ? specialized : cache).share(path));
+
+    Renderer renderer(*this, bridge, entry, output.dynamic, recompiled, lease.get(), path);
+    renderer.frozen      = frozen;
+    renderer.scatter     = &output;
+    renderer.owners      = &output.owners;
+    renderer.timeout     = timeout;
+    renderer.renderStart = chrono;
 
     renderer.render();
+    output.close();
 
     if(opts.flags.logRenderTime) {
         LOG_INFO("Rendered in %s\n", getf_exec_time_mis(chrono).c_str());
     }
+}
+
+Eryn::ScatterOutput::ScatterOutput() : dynamicStart(0) { }
+
+const uint8_t* Eryn::ScatterOutput::data(const Segment& segment) const {
+    return segment.data != nullptr ? segment.data : dynamic.data + segment.offset;
+}
+
+struct Eryn::RenderStream::State {
+    Eryn::Engine&                               engine;
+    std::unique_ptr<Eryn::Bridge>               bridge;
+    Eryn::RenderScratch                         scratch; // Not the engine's, since other renders can run between chunks.
+    std::unordered_set<std::string>             recompiled;
+    std::string                                 path;
+    Buffer                                      output;
+    std::vector<std::shared_ptr<const uint8_t>> owners; // The stream can outlive a recompilation of the files it renders.
+    std::unique_ptr<Renderer>                   renderer;
+    bool                                        chunked;
+    bool                                        done;
+
+    State(Eryn::Engine& engine, std::unique_ptr<Eryn::Bridge>&& bridge, const char* path, bool chunked)
+        : engine(engine), bridge(std::move(bridge)), path(path), chunked(chunked), done(false) { }
+};
+
+Eryn::RenderStream::RenderStream(Eryn::Engine& engine, std::unique_ptr<Eryn::Bridge>&& bridge, const char* path, size_t chunkSize, bool frozen)
+    : state(new State(engine, std::move(bridge), path, chunkSize != 0)) {
+    LOG_DEBUG("===> Rendering '%s' (stream)", path);
+
+    auto& bridgeRef = *state->bridge;
+
+    compile_for_render(engine, bridgeRef, path, state->recompiled);
+
+    auto entry = frozen ? engine.specialize(bridgeRef.to_compile_data(), bridgeRef.get_shared(), path) : engine.cache.get(path);
+    ::hold(state->owners, (frozen ? engine.specialized : engine.cache).share(path));
+
+    // Without chunks, the whole output is kept (and presized like for normal renders).
+    auto expected = state->chunked ? chunkSize : engine.cache.output_size(path);
+    state->output.reserve(expected + expected / OUTPUT_SIZE_MARGIN);
+
+    state->renderer.reset(new Renderer(engine, bridgeRef, entry, state->output, state->recompiled, state->scratch, state->path.c_str()));
+
+    auto& renderer = *state->renderer;
+
+    renderer.frozen      = frozen;
+    renderer.owners      = &state->owners;
+    renderer.renderStart = time_now();
+
+    if(state->chunked) {
+        renderer.chunkOutput = &state->output;
+        renderer.chunkSize   = chunkSize;
+        renderer.stoppable   = true;
+    }
+
+    renderer.start();
+}
+
+Eryn::RenderStream::~RenderStream() {
+    // The renderer uses the scratch memory, so it must go first.
+    state->renderer.reset();
+}
+
+bool Eryn::RenderStream::next(ConstBuffer& chunk) {
+    if(state->chunked) {
+        state->renderer->flushed += state->output.size;
+        state->output.clear();
+    }
+
+    if(state->done) {
+        chunk = ConstBuffer(nullptr, 0);
+        return false;
+    }
+
+    state->renderer->sliceStart = time_now();
+
+    try {
+        state->done = state->renderer->resume();
+    } catch(...) {
+        // The render can't continue after an error.
+        state->done = true;
+        throw;
+    }
+
+    chunk = ConstBuffer(state->output.data, state->output.size);
+    return true;
+}
+
+bool Eryn::RenderStream::done() const {
+    return state->done;
+}
+
+bool Eryn::RenderStream::chunked() const {
+    return state->chunked;
+}
+
+void Eryn::RenderStream::set_time_slice(uint64_t microseconds) {
+    auto& renderer = *state->renderer;
+
+    renderer.sliceLength = microseconds;
+    renderer.stoppable   = state->chunked || microseconds != 0;
+}
+
+void Eryn::RenderStream::set_timeout(uint64_t microseconds) {
+    state->renderer->timeout = microseconds;
+}
+
+ConstBuffer Eryn::RenderStream::take() {
+    auto& output = state->output;
+
+    state->engine.cache.record_output_size(state->path, output.size);
+
+    return output.finalize(std::max(output.capacity / OUTPUT_SHRINK_SLACK, OUTPUT_MIN_SLACK));
+}
+
+void Eryn::RenderStream::stash(Eryn::BridgeStash& stash) {
+    if(!state->done) {
+        state->renderer->stash(stash);
+    }
+}
+
+void Eryn::ScatterOutput::hold(std::shared_ptr<const uint8_t>&& owner) {
+    ::hold(owners, std::move(owner));
+}
 
-    return output.finalize();
+void Eryn::ScatterOutput::reference(const uint8_t* data, size_t size) {
+    close();
+    segments.push_back({ data, 0, size });
+}
+
+void Eryn::ScatterOutput::close() {
+    if(dynamic.size > dynamicStart) {
+        segments.push_back({ nullptr, dynamicStart, dynamic.size - dynamicStart });
+        dynamicStart = dynamic.size;
+    }
+}
+
+Eryn::Engine::Engine() { }
+
+Eryn::Engine::~Engine() { }
+
+void Eryn::Engine::freeze_shared() {
+    // The specialized OSH was created using the previous frozen object.
+    specialized.clear();
 }
 
 void Renderer::error(const char* msg, const char* description) {
-    throw Eryn::RenderingException(msg, description, meta.c_str());
+    throw Eryn::RenderingException(msg, description, std::string(reinterpret_cast<const char*>(meta.data), meta.size).c_str());
 }
 
 void Renderer::error(const char* msg, const char* description, ConstBuffer token) {
-    throw Eryn::RenderingException(msg, description, meta.c_str(), token);
+    throw Eryn::RenderingException(msg, description, std::string(reinterpret_cast<const char*>(meta.data), meta.size).c_str(), token);
 }
 
-void Renderer::render_component(ConstBuffer component, const Buffer& contentBuffer) {
-    std::string path(reinterpret_cast<const char*>(component.data), component.size);
+ConstBuffer Renderer::load_component(ConstBuffer component, bool& isStatic, bool& isPure) {
+    ++components;
+    check_deadline();
 
-    LOG_DEBUG("===> Rendering component '%s'", path.c_str());
+    // The scratch string keeps its memory between renders. Nested components overwrite it,
+    // but only after it's no longer needed here.
+    std::string& path = scratch.path;
+    path.assign(reinterpret_cast<const char*>(component.data), component.size);
 
     if(inputIsString) {
         if(!cache.has(path)) {
@@ -218,27 +843,264 @@ void Renderer::render_component(ConstBuffer component, const Buffer& contentBuff
         }
     }
 
-    auto entry = cache.get(path);
+    auto  entry  = frozen ? engine.specialize(bridge.to_compile_data(), bridge.get_shared(), path.c_str()) : cache.get(path);
+    auto& source = frozen ? engine.specialized : cache;
+
+    if(owners != nullptr) {
+        hold(*owners, source.share(path));
+    }
+
+    ConstBuffer text;
+    isStatic = source.get_static(path, text);
+    isPure   = opts.flags.memoizeComponents && source.is_pure(path);
+
+    return isStatic ? text : entry;
+}
+
+void Renderer::enter_component(ConstBuffer component, ConstBuffer osh, ConstBuffer context, Buffer* capture) {
+    LOG_DEBUG("===> Rendering component '%.*s'", static_cast<int>(component.size), component.data);
+
+    RenderFrame frame;
+
+    frame.contextBackup = bridge.backupContext(opts.flags.cloneBackups);
+    frame.localBackup   = bridge.backupLocal(opts.flags.cloneBackups);
+
+    bridge.initContext(context);
+    bridge.initLocal();
+
+    frame.input       = osh;
+    frame.index       = 0;
+    frame.content     = capture != nullptr ? ConstBuffer(capture->data, capture->size) : ConstBuffer(nullptr, 0);
+    frame.meta        = component;
+    frame.isComponent = true;
+    frame.capture     = capture;
+    frame.memo.active = false;
+
+    frames.push(frame);
+
+    input   = frame.input;
+    content = frame.content;
+    meta    = frame.meta;
+}
+
+// FNV-1a of the context, mixed with the slot.
+static uint64_t memo_hash(const uint8_t* slot, const Buffer& key) {
+    uint64_t hash = 14695981039346656037ull ^ reinterpret_cast<uintptr_t>(slot);
+
+    for(size_t i = 0; i < key.size; ++i) {
+        hash = (hash ^ key.data[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+bool Renderer::memoize_component(const uint8_t* slot, ConstBuffer component, bool isPure) {
+    if(!opts.flags.memoizeComponents) {
+        return false;
+    }
+
+    // The components around this one now have side effects too.
+    if(!isPure) {
+        for(size_t i = 0; i < frames.size(); ++i) {
+            frames[i].memo.active = false;
+        }
+
+        return false;
+    }
+
+    // Scatter renders reference large plaintext instead of copying it, so the output of a component isn't in one place.
+    if(scatter != nullptr) {
+        return false;
+    }
+
+    auto& memo = scratch.memo;
+
+    // The path is part of the key too, since the slot could be reused by a recompiled file (bypassCache).
+    memo.key.clear();
+    memo.key.write(component.data, component.size);
+
+    if(!bridge.serialize_context(memo.key, MEMO_MAX_KEY)) {
+        return false;
+    }
+
+    auto hash  = memo_hash(slot, memo.key);
+    auto found = memo.index.find(hash);
+
+    if(found != memo.index.end()) {
+        auto& entry = memo.entries[found->second];
+
+        if(entry.slot != slot || entry.keySize != memo.key.size || !mem::cmp(memo.keys.data + entry.keyOffset, memo.key.data, memo.key.size)) {
+            return false;
+        }
+
+        LOG_DEBUG("===> Memoized component (%zu bytes)", entry.outputSize);
+
+        output->write(memo.outputs.data + entry.outputOffset, entry.outputSize);
+        leave_frame();
+
+        return true;
+    }
+
+    if(memo.keys.size + memo.key.size > MEMO_MAX_BYTES || memo.outputs.size >= MEMO_MAX_BYTES) {
+        return false;
+    }
+
+    auto& record = frames.top().memo;
+
+    record.active    = true;
+    record.slot      = slot;
+    record.hash      = hash;
+    record.keyOffset = memo.keys.size;
+    record.keySize   = memo.key.size;
+    record.output    = output;
+    record.start     = output->size;
+    record.flushed   = flushed;
+
+    memo.keys.write(memo.key.data, memo.key.size);
+
+    return false;
+}
+
+void Renderer::leave_frame() {
+    RenderFrame frame = frames.top();
+    frames.pop();
+
+    if(frame.memo.active && frame.memo.output == output && frame.memo.flushed == flushed) {
+        auto& memo = scratch.memo;
+        auto  size = output->size - frame.memo.start;
+
+        if(size <= MEMO_MAX_OUTPUT && memo.outputs.size + size <= MEMO_MAX_BYTES && memo.index.find(frame.memo.hash) == memo.index.end()) {
+            memo.index.emplace(frame.memo.hash, memo.entries.size());
+            memo.entries.push_back({ frame.memo.slot, frame.memo.keyOffset, frame.memo.keySize, memo.outputs.size, size });
+
+            memo.outputs.write(output->data + frame.memo.start, size);
+        }
+    }
+
+    if(frame.isComponent) {
+        bridge.restoreContext(frame.contextBackup);
+        bridge.restoreLocal(frame.localBackup);
+
+        if(frame.capture != nullptr) {
+            captures.release(frame.capture);
+        }
+
+        LOG_DEBUG("===> Done\n");
+    }
+
+    if(!frames.empty()) {
+        input   = frames.top().input;
+        content = frames.top().content;
+        meta    = frames.top().meta;
+    }
+}
+
+void Renderer::write_plaintext(const uint8_t* data, size_t size) {
+    // Plaintext in component content is still copied, since the capture buffers are reused.
+    if(scatter != nullptr && output == &scatter->dynamic && size >= SCATTER_MIN_SEGMENT) {
+        scatter->reference(data, size);
+    } else {
+        output->write(data, size);
+    }
+}
+
+void Renderer::check_deadline() {
+    if(timeout == 0 || ++deadlineCounter % SLICE_CHECK_INTERVAL != 0) {
+        return;
+    }
+
+    auto elapsed = get_exec_time_mis(renderStart);
+
+    if(elapsed >= timeout) {
+        std::string path(reinterpret_cast<const char*>(frames[0].meta.data), frames[0].meta.size);
+        throw Eryn::RenderingAbortedException(path.c_str(), { flushed + root->size, iterations, components, elapsed });
+    }
+}
+
+bool Renderer::should_stop(size_t inputIndex) {
+    if(sliceLength != 0 && ++sliceCounter % SLICE_CHECK_INTERVAL == 0 && get_exec_time_mis(sliceStart) >= sliceLength) {
+        return true;
+    }
 
-    auto subrenderer    = *this;
-    subrenderer.input   = entry;
-    subrenderer.content = ConstBuffer(contentBuffer.data, contentBuffer.size);
-    subrenderer.meta    = path;
+    if(chunkOutput == nullptr || output != chunkOutput) {
+        return false; // Capturing component content.
+    }
 
-    subrenderer.render();
+    if(!prefixDone && input.data[inputIndex + BDP832.NAME_LENGTH_BYTE_SIZE] != *OSH_PLAINTEXT) {
+        prefixDone = true;
+        return output->size > 0;
+    }
 
-    LOG_DEBUG("===> Done\n");
+    return output->size >= chunkSize;
+}
+
+void Renderer::stash(Eryn::BridgeStash& stash) {
+    bridge.stash(stash);
+
+    for(size_t i = 0; i < loopStack.size(); ++i) {
+        stash(loopStack[i].iterable);
+
+        for(auto& key : loopStack[i].keys) {
+            stash(key);
+        }
+    }
+
+    for(size_t i = 0; i < localStack.size(); ++i) {
+        stash(localStack[i]);
+    }
+
+    for(size_t i = 0; i < frames.size(); ++i) {
+        if(frames[i].isComponent) {
+            stash(frames[i].contextBackup);
+            stash(frames[i].localBackup);
+        }
+    }
 }
 
 void Renderer::render() {
-    size_t inputIndex  = 0;
+    start();
+    resume();
+}
+
+void Renderer::start() {
+    RenderFrame frame;
+
+    frame.input       = input;
+    frame.index       = 0;
+    frame.content     = content;
+    frame.meta        = meta;
+    frame.isComponent = false;
+    frame.capture     = nullptr;
+    frame.memo.active = false;
+
+    frames.push(frame);
+}
+
+bool Renderer::resume() {
+    size_t inputIndex  = frames.top().index;
     size_t nameLength  = 0;
     size_t valueLength = 0;
 
     const uint8_t* name;
     const uint8_t* value;
 
-    while(inputIndex < input.size) {
+    while(true) {
+        if(inputIndex >= input.size) {
+            leave_frame();
+
+            if(frames.empty()) {
+                return true;
+            }
+
+            inputIndex = frames.top().index;
+            continue;
+        }
+
+        if(stoppable && should_stop(inputIndex)) {
+            frames.top().index = inputIndex;
+            return false;
+        }
+
         BDP::bytesToLength(nameLength, input.data + inputIndex, BDP832.NAME_LENGTH_BYTE_SIZE);
         inputIndex += BDP832.NAME_LENGTH_BYTE_SIZE;
         name = input.data + inputIndex;
@@ -256,7 +1118,7 @@ void Renderer::render() {
             case *OSH_PLAINTEXT: {
                 LOG_DEBUG("--> Found plaintext");
 
-                output.write(value, valueLength);
+                write_plaintext(value, valueLength);
                 break;
             }
             case *OSH_TEMPLATE: {
@@ -268,10 +1130,10 @@ void Renderer::render() {
                             error("No content", "there is no content for this component", { value, valueLength });
                         }
                     } else {
-                        output.write(content);
+                        output->write(content);
                     }
                 } else {
-                    bridge.evalTemplate({ value, valueLength }, output);
+                    bridge.evalTemplate({ value, valueLength }, *output);
                 }
 
                 break;
@@ -401,7 +1263,7 @@ void Renderer::render() {
                 right = input.data + inputIndex;
                 inputIndex += rightLength;
 
-                loopStack.push(LoopStackInfo(bridge, { left, leftLength }, { right, rightLength }, nameByte == *OSH_TEMPLATE_LOOP_REVERSE_START ? -1 : 1));
+                loopStack.emplace(bridge, scratch.arena, ConstBuffer(left, leftLength), ConstBuffer(right, rightLength), nameByte == *OSH_TEMPLATE_LOOP_REVERSE_START ? -1 : 1);
 
                 if(loopStack.top().length == 0) {
                     size_t loopEnd;
@@ -425,6 +1287,9 @@ void Renderer::render() {
                 LOG_DEBUG("--> Found loop template end");
 
                 if(!loopStack.top().end()) {
+                    ++iterations;
+                    check_deadline();
+
                     if(opts.flags.cloneLocalInLoops) {
                         // For when the array uses the parent local object and the local changes in an inner scope.
                         bridge.restoreLocal(bridge.copyValue(localStack.top()));
@@ -479,19 +1344,27 @@ void Renderer::render() {
                 if(contentLength == 0) {
                     info.hasContent = false;
 
-                    auto contextBackup = bridge.backupContext(opts.flags.cloneBackups);
-                    auto localBackup   = bridge.backupLocal(opts.flags.cloneBackups);
+                    bool isStatic;
+                    bool isPure;
+                    auto osh = load_component({ info.path, info.pathLength }, isStatic, isPure);
 
-                    bridge.initContext({ info.context, info.contextLength });
-                    bridge.initLocal();
-
-                    render_component({ info.path, info.pathLength }, { nullptr, 0 });
+                    // Static components don't read their context, so there's nothing to set up.
+                    if(isStatic) {
+                        write_plaintext(osh.data, osh.size);
+                    } else {
+                        frames.top().index = inputIndex;
+                        enter_component({ info.path, info.pathLength }, osh, { info.context, info.contextLength }, nullptr);
 
-                    bridge.restoreContext(contextBackup);
-                    bridge.restoreLocal(localBackup);
+                        // The component is keyed by its pair in the OSH, which stays in place for the whole render.
+                        inputIndex = memoize_component(name, { info.path, info.pathLength }, isPure) ? frames.top().index : 0;
+                    }
                 } else {
-                    info.hasContent = true;
-                    info.startIndex = output.size;
+                    info.hasContent     = true;
+                    info.capture        = captures.acquire();
+                    info.previousOutput = output;
+
+                    // The content is rendered directly into the capture buffer, and passed to the component as it is.
+                    output = info.capture;
                 }
 
                 // Even if the component has no content and it has already been rendered, push it.
@@ -503,30 +1376,31 @@ void Renderer::render() {
                 LOG_DEBUG("--> Found component template end");
 
                 ComponentStackInfo info = componentStack.top();
+                componentStack.pop();
 
                 if(info.hasContent) {
-                    // TODO: maybe write directly to a content buffer?
-
-                    auto contentLength = output.size - info.startIndex;
-                    Buffer content;
-
-                    content.write(output.data + info.startIndex, contentLength);
+                    output = info.previousOutput;
 
-                    output.size = info.startIndex;
+                    bool isStatic;
+                    bool isPure;
+                    auto osh = load_component({ info.path, info.pathLength }, isStatic, isPure);
 
-                    auto contextBackup = bridge.backupContext(opts.flags.cloneBackups);
-                    auto localBackup   = bridge.backupLocal(opts.flags.cloneBackups);
-
-                    bridge.initContext({ info.context, info.contextLength });
-                    bridge.initLocal();
+                    // Components with content aren't memoized (the content can be different every time), but their side effects count.
+                    if(!isPure) {
+                        memoize_component(nullptr, {}, false);
+                    }
 
-                    render_component({ info.path, info.pathLength }, content);
-                    
-                    bridge.restoreContext(contextBackup);
-                    bridge.restoreLocal(localBackup);
+                    // The content was rendered anyway (it can have side effects), but a static component doesn't use it.
+                    if(isStatic) {
+                        write_plaintext(osh.data, osh.size);
+                        captures.release(info.capture);
+                    } else {
+                        frames.top().index = inputIndex;
+                        enter_component({ info.path, info.pathLength }, osh, { info.context, info.contextLength }, info.capture);
+                        inputIndex = 0;
+                    }
                 }
 
-                componentStack.pop();
                 break;
             }
             default:
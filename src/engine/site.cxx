@@ -0,0 +1,352 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <unordered_set>
+#include <algorithm>
+
+#include "engine.hxx"
+
+#include "../def/os.dxx"
+#include "../def/logging.dxx"
+
+#include "../../lib/buffer.hxx"
+#include "../../lib/timer.hxx"
+
+#ifdef OS_WINDOWS
+    #include <direct.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <limits.h>
+    #include <sys/stat.h>
+    #include <sys/uio.h>
+#endif
+
+#if !defined(IOV_MAX)
+    #define IOV_MAX 1024
+#endif
+
+// This many items are in flight (being read, rendered or written).
+// Rendering is usually the slowest part, so a few are enough to keep the IO ahead of it.
+static constexpr size_t SITE_ITEMS_IN_FLIGHT = 8;
+
+// Existing outputs are compared in blocks of this size.
+static constexpr size_t SITE_COMPARE_BLOCK = 64 * 1024;
+
+// An item that is in flight. The IO thread reads its data file, and (after it's rendered) writes its output,
+// then reads the data file of the item that comes SITE_ITEMS_IN_FLIGHT later into the same slot.
+// The output is only reset by the main thread, since it was allocated with remem.
+struct SiteSlot {
+    std::vector<uint8_t>                 data;
+    std::unique_ptr<Eryn::ScatterOutput> output;
+    std::atomic<bool>                    ready;
+
+    SiteSlot() : ready(false) {
+    }
+};
+
+// The first error of the IO thread (IO errors, which stop the build).
+struct SiteError {
+    std::mutex        lock;
+    std::atomic<bool> failed;
+    size_t            index;
+    string            msg;
+    string            description;
+
+    SiteError() : failed(false), index(0) {
+    }
+
+    void set(size_t item, const char* message, const string& what) {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if(failed) {
+            return;
+        }
+
+        index       = item;
+        msg         = message;
+        description = what;
+        failed      = true;
+    }
+};
+
+static string describe_errno() {
+    return string(strerror(errno));
+}
+
+static bool read_file(const char* path, std::vector<uint8_t>& data) {
+    FILE* input = fopen(path, "rb");
+
+    if(input == NULL) {
+        return false;
+    }
+
+    fseek(input, 0, SEEK_END);
+    long fileLength = ftell(input);
+    fseek(input, 0, SEEK_SET);
+
+    data.resize(fileLength > 0 ? static_cast<size_t>(fileLength) : 0);
+
+    bool success = fread(data.data(), 1, data.size(), input) == data.size();
+    fclose(input);
+
+    return success;
+}
+
+// Returns true if the file exists and has the same content as the output.
+static bool same_content(const char* path, const Eryn::ScatterOutput& output, size_t size) {
+    FILE* input = fopen(path, "rb");
+
+    if(input == NULL) {
+        return false;
+    }
+
+    fseek(input, 0, SEEK_END);
+    long fileLength = ftell(input);
+    fseek(input, 0, SEEK_SET);
+
+    bool same = fileLength >= 0 && static_cast<size_t>(fileLength) == size;
+
+    // Not new[], which is remem's.
+    std::vector<uint8_t> block(same ? SITE_COMPARE_BLOCK : 0);
+
+    for(size_t i = 0; same && i < output.segments.size(); ++i) {
+        auto data      = output.data(output.segments[i]);
+        auto remaining = output.segments[i].size;
+
+        while(same && remaining > 0) {
+            auto count = std::min(remaining, SITE_COMPARE_BLOCK);
+
+            same = fread(block.data(), 1, count, input) == count && memcmp(block.data(), data, count) == 0;
+
+            data      += count;
+            remaining -= count;
+        }
+    }
+
+    fclose(input);
+
+    return same;
+}
+
+// Creates the directories of the path (but not the last component). The directories that were already created
+// are kept in 'created', so that the outputs in the same directory only call mkdir once.
+static void make_parent_dirs(const string& path, std::unordered_set<string>& created) {
+    auto end = path.find_last_of("/\\");
+
+    if(end == string::npos || created.count(string(path, 0, end)) > 0) {
+        return;
+    }
+
+    for(size_t i = 1; i <= end; ++i) {
+        if(path[i] != '/' && path[i] != '\\') {
+            continue;
+        }
+
+        // Skip drive letters (e.g. 'C:/').
+        if(path[i - 1] == ':') {
+            continue;
+        }
+
+        string dir(path, 0, i);
+
+        if(!created.insert(dir).second) {
+            continue;
+        }
+
+#ifdef OS_WINDOWS
+        _mkdir(dir.c_str());
+#else
+        mkdir(dir.c_str(), 0755);
+#endif
+    }
+}
+
+// Writes the segments as they are (with writev where available, so they don't have to be joined first).
+static bool write_output(const char* path, const Eryn::ScatterOutput& output) {
+#ifdef OS_WINDOWS
+    FILE* file = fopen(path, "wb");
+
+    if(file == NULL) {
+        return false;
+    }
+
+    bool success = true;
+
+    for(const auto& segment : output.segments) {
+        success = success && fwrite(output.data(segment), 1, segment.size, file) == segment.size;
+    }
+
+    return fclose(file) == 0 && success;
+#else
+    int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(file < 0) {
+        return false;
+    }
+
+    std::vector<struct iovec> vectors;
+    vectors.reserve(output.segments.size());
+
+    for(const auto& segment : output.segments) {
+        vectors.push_back({ const_cast<uint8_t*>(output.data(segment)), segment.size });
+    }
+
+    size_t index = 0;
+
+    while(index < vectors.size()) {
+        auto count   = std::min(vectors.size() - index, static_cast<size_t>(IOV_MAX));
+        auto written = writev(file, vectors.data() + index, static_cast<int>(count));
+
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            close(file);
+            return false;
+        }
+
+        // Skip the vectors that were written, and continue from the middle of the one that was written partially.
+        auto remaining = static_cast<size_t>(written);
+
+        while(index < vectors.size() && remaining >= vectors[index].iov_len) {
+            remaining -= vectors[index].iov_len;
+            ++index;
+        }
+
+        if(remaining > 0) {
+            vectors[index].iov_base = static_cast<uint8_t*>(vectors[index].iov_base) + remaining;
+            vectors[index].iov_len -= remaining;
+        }
+    }
+
+    return close(file) == 0;
+#endif
+}
+
+Eryn::SiteStats Eryn::Engine::build_site(Eryn::Bridge& bridge, const std::vector<Eryn::SiteItem>& items, bool skipUnchanged, bool frozen, size_t& failed) {
+    LOG_DEBUG("===> Building %zu pages", items.size());
+
+    CHRONOMETER chrono = time_now();
+
+    SiteError           error;
+    std::atomic<size_t> written(0);
+    std::atomic<size_t> skipped(0);
+    std::atomic<size_t> bytes(0);
+
+    // Only used by the IO thread.
+    std::unordered_set<string> directories;
+
+    auto window = std::min(items.size(), SITE_ITEMS_IN_FLIGHT);
+
+    std::vector<SiteSlot> slots(window);
+    IOThread              io; // Declared after the slots, so that it's stopped before they are destroyed.
+
+    auto read = [&](SiteSlot& slot, size_t index) {
+        auto& item = items[index];
+
+        if(item.data.empty()) {
+            slot.data.clear();
+        } else if(!read_file(item.data.c_str(), slot.data)) {
+            error.set(index, "Cannot read data file", item.data + ": " + describe_errno());
+        }
+    };
+
+    auto write = [&](SiteSlot& slot, size_t index) {
+        auto& item   = items[index];
+        auto& output = *slot.output;
+
+        size_t size = 0;
+
+        for(const auto& segment : output.segments) {
+            size += segment.size;
+        }
+
+        if(skipUnchanged && same_content(item.output.c_str(), output, size)) {
+            ++skipped;
+            return;
+        }
+
+        make_parent_dirs(item.output, directories);
+
+        if(!write_output(item.output.c_str(), output)) {
+            error.set(index, "Cannot write output file", item.output + ": " + describe_errno());
+            return;
+        }
+
+        ++written;
+        bytes += size;
+    };
+
+    for(size_t i = 0; i < window; ++i) {
+        io.submit([&, i]() {
+            read(slots[i], i);
+            slots[i].ready = true;
+        });
+    }
+
+    size_t index = 0;
+
+    try {
+        for(; index < items.size() && !error.failed; ++index) {
+            auto& slot = slots[index % window];
+
+            io.wait_until([&slot]() { return slot.ready.load(); });
+
+            if(error.failed) {
+                break;
+            }
+
+            // The handles of the page (its context and whatever the render creates) are released before the next one.
+            Napi::HandleScope scope(bridge.to_compile_data().env);
+
+            BridgeBackup context;
+
+            try {
+                context = Bridge::parse_json(bridge.to_compile_data(), ConstBuffer(slot.data.data(), slot.data.size()));
+            } catch(std::exception& e) {
+                throw RenderingException("Invalid data file", e.what(), items[index].data.c_str());
+            }
+
+            bridge.reset(context, bridge.get_shared());
+
+            slot.output.reset(new ScatterOutput());
+            render_scatter(bridge, items[index].path.c_str(), *slot.output, frozen);
+
+            slot.ready = false;
+
+            io.submit([&, index]() {
+                auto& slot = slots[index % window];
+
+                write(slot, index);
+
+                if(index + window < items.size() && !error.failed) {
+                    read(slot, index + window);
+                }
+
+                slot.ready = true;
+            });
+        }
+
+        io.wait_all();
+    } catch(...) {
+        failed = index;
+        io.wait_all();
+        throw;
+    }
+
+    if(error.failed) {
+        failed = error.index;
+        throw RenderingException(error.msg.c_str(), error.description.c_str());
+    }
+
+    if(opts.flags.logRenderTime) {
+        LOG_INFO("Built %zu pages in %s\n", items.size(), getf_exec_time_mis(chrono).c_str());
+    }
+
+    return { items.size(), written, skipped, bytes };
+}
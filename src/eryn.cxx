@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <cctype>
+#include <cmath>
 
 #include "def/logging.dxx"
 #include "def/macro.dxx"
@@ -15,9 +16,123 @@
 #include "../lib/path.hxx"
 #include "../lib/remem.hxx"
 
-void finalize_buffer(Napi::Env, uint8_t* data) {
+// The capacity of the output is passed as the hint, since the pool needs it (and V8 was told about all of it).
+void finalize_output(Napi::Env env, uint8_t* data, void* hint) {
     LOG_DEBUG("Finalizing buffer %p", data);
-    REMEM_FREE(data);
+
+    auto capacity = static_cast<int64_t>(reinterpret_cast<uintptr_t>(hint));
+
+    Napi::MemoryManagement::AdjustExternalMemory(env, -capacity);
+
+    auto& pool = Eryn::OutputPool::local();
+
+    pool.track_external(-capacity);
+    pool.release(data, static_cast<size_t>(capacity));
+}
+
+// Renders of static entries point into the cache, so the buffer holds a reference to the cached OSH.
+void finalize_shared_buffer(Napi::Env, uint8_t*, std::shared_ptr<const uint8_t>* owner) {
+    delete owner;
+}
+
+// The output memory is reported to V8, so that large renders put pressure on the GC (which gives the memory back).
+// If the capacity isn't known, the size is used instead (the pool only needs a lower bound).
+static Napi::Value to_js_buffer(Napi::Env env, ConstBuffer rendered, std::shared_ptr<const uint8_t>& owner, size_t capacity = 0) {
+    if (owner) {
+        return Napi::Buffer<uint8_t>::New(env, (uint8_t*) rendered.data, rendered.size, finalize_shared_buffer,
+                                          new std::shared_ptr<const uint8_t>(std::move(owner)));
+    }
+
+    capacity = std::max(capacity, rendered.size);
+
+    Napi::MemoryManagement::AdjustExternalMemory(env, static_cast<int64_t>(capacity));
+    Eryn::OutputPool::local().track_external(static_cast<int64_t>(capacity));
+
+    return Napi::Buffer<uint8_t>::New(env, (uint8_t*) rendered.data, rendered.size, finalize_output, reinterpret_cast<void*>(static_cast<uintptr_t>(capacity)));
+}
+
+// Keeps a scatter render (and the cached OSH it points into) alive until all of its JS buffers are collected.
+struct ScatterHandle {
+    Eryn::ScatterOutput output;
+    size_t              references;
+};
+
+void finalize_segment(Napi::Env, uint8_t*, ScatterHandle* handle) {
+    if (--handle->references == 0) {
+        LOG_DEBUG("Finalizing scatter output %p", handle);
+        delete handle;
+    }
+}
+
+// Aborted renders get a code and the progress of the render, so that they can be told apart from other errors.
+static Napi::Error rendering_error(Napi::Env env, const std::string& path, const std::exception& e) {
+    auto error   = Napi::Error::New(env, ((std::string("Rendering error in '") + path) + "'\n") + e.what());
+    auto aborted = dynamic_cast<const Eryn::RenderingAbortedException*>(&e);
+
+    if (aborted != nullptr) {
+        auto progress = Napi::Object::New(env);
+
+        progress.Set("bytes", Napi::Number::New(env, static_cast<double>(aborted->progress.bytes)));
+        progress.Set("iterations", Napi::Number::New(env, static_cast<double>(aborted->progress.iterations)));
+        progress.Set("components", Napi::Number::New(env, static_cast<double>(aborted->progress.components)));
+        progress.Set("elapsed", Napi::Number::New(env, aborted->progress.elapsed / 1000.0));
+
+        error.Value().Set("code", Napi::String::New(env, "ERYN_RENDER_ABORTED"));
+        error.Value().Set("progress", progress);
+    }
+
+    return error;
+}
+
+// Timeouts are passed in milliseconds (0 or missing for none), and the engine takes microseconds.
+static uint64_t get_timeout(const Napi::CallbackInfo& info, size_t index) {
+    if (info.Length() <= index || !info[index].IsNumber()) {
+        return 0;
+    }
+
+    auto timeout = info[index].As<Napi::Number>().DoubleValue();
+
+    return timeout > 0 ? static_cast<uint64_t>(std::ceil(timeout * 1000)) : 0;
+}
+
+// Keeps a streamed render between chunks, along with the JS values it uses (see Eryn::RenderStream::stash).
+struct StreamHandle {
+    std::unique_ptr<Eryn::RenderStream> stream;
+    Napi::ObjectReference               stash;
+    std::string                         path;
+};
+
+void finalize_stream(Napi::Env, StreamHandle* handle) {
+    LOG_DEBUG("Finalizing stream %p", handle);
+    delete handle;
+}
+
+// Converts a primitive value to a JavaScript literal. Returns an empty string for other values.
+static std::string to_literal(Napi::Env env, const Napi::Value& value) {
+    if (value.IsString()) {
+        auto json = env.Global().Get("JSON").As<Napi::Object>();
+        auto stringify = json.Get("stringify").As<Napi::Function>();
+
+        return stringify.Call(json, { value }).As<Napi::String>().Utf8Value();
+    } else if (value.IsNumber() || value.IsBoolean() || value.IsNull() || value.IsUndefined()) {
+        return value.ToString().Utf8Value();
+    }
+
+    return "";
+}
+
+static bool is_identifier(const std::string& name) {
+    if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) {
+        return false;
+    }
+
+    for (auto c : name) {
+        if (!str::valid_in_token(c)) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
 void update_options(Eryn::Options& opts, const Napi::Object& data) {
@@ -63,6 +178,13 @@ void update_options(Eryn::Options& opts, const Napi::Object& data) {
         else FLAG_ENTRY(cloneBackups)
         else FLAG_ENTRY(cloneLocalInLoops)
         else FLAG_ENTRY(debugDumpOSH)
+        else FLAG_ENTRY(inlineStaticComponents)
+        else FLAG_ENTRY(mergePlaintext)
+        else FLAG_ENTRY(foldConstants)
+        else FLAG_ENTRY(minifyHTML)
+        else FLAG_ENTRY(batchCompileHook)
+        else FLAG_ENTRY(memoizeCompileHook)
+        else FLAG_ENTRY(memoizeComponents)
         else TEMPLATE_ENTRY2(templateStart, start)
         else TEMPLATE_ENTRY2(templateEnd, end)
         else TEMPLATE_ENTRY(bodyEnd)
@@ -93,6 +215,32 @@ void update_options(Eryn::Options& opts, const Napi::Object& data) {
             }
 
             result.templates.escape = value.ToString().Utf8Value()[0];
+        } else if (key == "inlineThreshold") {
+            if (!value.IsNumber() || value.As<Napi::Number>().DoubleValue() < 0) {
+                continue;
+            }
+
+            result.inlineThreshold = static_cast<size_t>(value.As<Napi::Number>().DoubleValue());
+        } else if (key == "defines") {
+            if (!value.IsObject()) {
+                continue;
+            }
+
+            auto        defines    = value.As<Napi::Object>();
+            Napi::Array defineKeys = defines.GetPropertyNames();
+
+            result.defines.clear();
+
+            for (uint32_t j = 0; j < defineKeys.Length(); ++j) {
+                auto name    = static_cast<Napi::Value>(defineKeys[j]).ToString().Utf8Value();
+                auto literal = to_literal(data.Env(), defines.Get(name));
+
+                if (!is_identifier(name) || literal.empty()) {
+                    continue;
+                }
+
+                result.defines[name] = literal;
+            }
         } else if (key == "mode") {
             if (!value.IsString()) {
                 continue;
@@ -110,11 +258,26 @@ void update_options(Eryn::Options& opts, const Napi::Object& data) {
                 result.mode = Eryn::EngineMode::STRICT;
             }
         }  else if (key == "compileHook") {
+            if (value.IsString()) { // Path of a native plugin.
+                std::string error;
+                auto        plugin = Eryn::HookPlugin::load(value.As<Napi::String>().Utf8Value(), error);
+
+                if (!plugin) {
+                    throw Napi::Error::New(data.Env(), "Cannot load compile hook plugin: " + error);
+                }
+
+                result.compilePlugin = std::move(plugin);
+                result.compileHook.Reset();
+
+                continue;
+            }
+
             if (!value.IsFunction()) {
                 continue;
             }
 
             result.compileHook = Napi::Persistent(value.As<Napi::Function>());
+            result.compilePlugin.reset();
         }
         // clang-format on
 
@@ -143,6 +306,13 @@ Napi::Object get_options(Napi::Env env, const Eryn::Options& opts) {
     FLAG_ENTRY(cloneBackups);
     FLAG_ENTRY(cloneLocalInLoops);
     FLAG_ENTRY(debugDumpOSH);
+    FLAG_ENTRY(inlineStaticComponents);
+    FLAG_ENTRY(mergePlaintext);
+    FLAG_ENTRY(foldConstants);
+    FLAG_ENTRY(minifyHTML);
+    FLAG_ENTRY(batchCompileHook);
+    FLAG_ENTRY(memoizeCompileHook);
+    FLAG_ENTRY(memoizeComponents);
     TEMPLATE_ENTRY2(templateEscape, escape);
     TEMPLATE_ENTRY2(templateStart, start);
     TEMPLATE_ENTRY2(templateEnd, end);
@@ -161,20 +331,43 @@ Napi::Object get_options(Napi::Env env, const Eryn::Options& opts) {
     TEMPLATE_ENTRY(componentSelf);
 
     result["workingDirectory"] = opts.workingDir;
+    result["inlineThreshold"]  = static_cast<double>(opts.inlineThreshold);
     result["mode"]             = (opts.mode == Eryn::EngineMode::NORMAL) ? "normal" : "strict";
 
+    auto defines = Napi::Object::New(env);
+    auto eval    = env.Global().Get("eval").As<Napi::Function>();
+
+    // The defines are literals, so evaluating them gives back the values.
+    for (const auto& define : opts.defines) {
+        defines[define.first] = eval.Call(std::initializer_list<napi_value>({ Napi::String::New(env, define.second) }));
+    }
+
+    result["defines"] = defines;
+
     return result;
 }
 
 class ErynEngine : public Napi::ObjectWrap<ErynEngine> {
     Eryn::Engine engine;
 
+    // The shared object for which the engine has specialized OSH (see Engine::specialize).
+    Napi::ObjectReference frozenShared;
+
     Napi::Value options(const Napi::CallbackInfo& info);
     Napi::Value compile(const Napi::CallbackInfo& info);
     Napi::Value compile_dir(const Napi::CallbackInfo& info);
     Napi::Value compile_string(const Napi::CallbackInfo& info);
     Napi::Value render(const Napi::CallbackInfo& info);
     Napi::Value render_string(const Napi::CallbackInfo& info);
+    Napi::Value render_segments(const Napi::CallbackInfo& info);
+    Napi::Value render_into(const Napi::CallbackInfo& info);
+    Napi::Value render_many(const Napi::CallbackInfo& info);
+    Napi::Value build_site(const Napi::CallbackInfo& info);
+    Napi::Value render_stream(const Napi::CallbackInfo& info);
+    Napi::Value stream_next(const Napi::CallbackInfo& info);
+    Napi::Value freeze_shared(const Napi::CallbackInfo& info);
+
+    bool is_frozen(const Napi::Value& shared) const;
 
     public:
     static Napi::Object Init(Napi::Env env, Napi::Object exports);
@@ -185,9 +378,13 @@ Napi::Object ErynEngine::Init(Napi::Env env, Napi::Object exports) {
     Napi::Function fn = DefineClass(env, "ErynEngine",
                                     { InstanceMethod<&ErynEngine::options>("options"), InstanceMethod<&ErynEngine::compile>("compile"),
                                       InstanceMethod<&ErynEngine::compile_dir>("compileDir"), InstanceMethod<&ErynEngine::compile_string>("compileString"),
-                                      InstanceMethod<&ErynEngine::render>("render"), InstanceMethod<&ErynEngine::render_string>("renderString") });
+                                      InstanceMethod<&ErynEngine::render>("render"), InstanceMethod<&ErynEngine::render_string>("renderString"),
+                                      InstanceMethod<&ErynEngine::render_segments>("renderSegments"), InstanceMethod<&ErynEngine::render_into>("renderInto"),
+                                      InstanceMethod<&ErynEngine::render_many>("renderMany"), InstanceMethod<&ErynEngine::render_stream>("renderStream"),
+                                      InstanceMethod<&ErynEngine::stream_next>("streamNext"), InstanceMethod<&ErynEngine::freeze_shared>("freezeShared"),
+                                      InstanceMethod<&ErynEngine::build_site>("buildSite") });
 
-    auto ctor = new("Eryn ctor function reference") Napi::FunctionReference();
+    auto ctor = new Napi::FunctionReference();
     *ctor     = Napi::Persistent(fn);
     exports.Set("ErynEngine", fn);
 
@@ -211,6 +408,10 @@ Napi::Value ErynEngine::options(const Napi::CallbackInfo& info) {
         return get_options(env, engine.opts);
     } else {
         update_options(engine.opts, info[0].As<Napi::Object>());
+
+        // The memoized results may belong to a different hook.
+        engine.hookMemo.clear();
+
         return get_options(env, engine.opts);
     }
 }
@@ -300,25 +501,30 @@ Napi::Value ErynEngine::render(const Napi::CallbackInfo& info) {
     auto absPath    = path::append_or_absolute(engine.opts.workingDir, pathString);
     path::normalize(absPath);
 
+    // Static templates are copied, unless the caller accepts a buffer that points into the cache.
+    auto shareStatic = info[7].ToBoolean().Value();
+
     try {
         ConstBuffer rendered;
+        std::shared_ptr<const uint8_t> owner;
+        size_t capacity = 0;
 
         if (engine.opts.mode == Eryn::EngineMode::NORMAL) {
             Eryn::NormalBridge bridge({ env, info[1].As<Napi::Value>(), info[2].As<Napi::Object>(), info[3].As<Napi::Value>(),
                                         info[4].As<Napi::Function>(), info[5].As<Napi::Function>() });
 
-            rendered = engine.render(bridge, absPath.c_str());
+            rendered = engine.render(bridge, absPath.c_str(), is_frozen(info[3]), shareStatic ? &owner : nullptr, get_timeout(info, 6), &capacity);
         } else {
             Eryn::StrictBridge bridge({ env, info[1].As<Napi::Value>(), info[2].As<Napi::Object>(), info[3].As<Napi::Value>(),
                                         info[4].As<Napi::Function>(), info[5].As<Napi::Function>() });
 
-            rendered = engine.render(bridge, absPath.c_str());
+            rendered = engine.render(bridge, absPath.c_str(), false, shareStatic ? &owner : nullptr, get_timeout(info, 6), &capacity);
         }
 
-        return Napi::Buffer<uint8_t>::New<decltype(finalize_buffer)*>(env, (uint8_t*) rendered.data, rendered.size, finalize_buffer);
+        return to_js_buffer(env, rendered, owner, capacity);
     } catch (std::exception& e) {
         // TODO: remove the path from RenderingException
-        throw Napi::Error::New(env, ((std::string("Rendering error in '") + absPath.c_str()) + "'\n") + e.what());
+        throw rendering_error(env, absPath, e);
     }
 }
 
@@ -330,18 +536,397 @@ Napi::Value ErynEngine::render_string(const Napi::CallbackInfo& info) {
         Eryn::NormalBridge bridge({ env, info[1].As<Napi::Value>(), info[2].As<Napi::Object>(), info[3].As<Napi::Value>(),
                                     info[4].As<Napi::Function>(), info[5].As<Napi::Function>() });
 
-        auto rendered = engine.render_string(bridge, alias.c_str());
+        std::shared_ptr<const uint8_t> owner;
+        size_t capacity = 0;
+        auto shareStatic = info[7].ToBoolean().Value();
+        auto rendered    = engine.render_string(bridge, alias.c_str(), is_frozen(info[3]), shareStatic ? &owner : nullptr, get_timeout(info, 6), &capacity);
 
-        return Napi::Buffer<uint8_t>::New<decltype(finalize_buffer)*>(env, (uint8_t*) rendered.data, rendered.size, finalize_buffer);
+        return to_js_buffer(env, rendered, owner, capacity);
     } catch (std::exception& e) {
         // TODO: remove the path from RenderingException
-        throw Napi::Error::New(env, ((std::string("Rendering error in '") + alias.c_str()) + "'\n") + e.what());
+        throw rendering_error(env, alias, e);
+    }
+}
+
+Napi::Value ErynEngine::render_segments(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+
+    auto pathString = info[0].As<Napi::String>().Utf8Value();
+    auto absPath    = path::append_or_absolute(engine.opts.workingDir, pathString);
+    path::normalize(absPath);
+
+    std::unique_ptr<ScatterHandle> handle(new ScatterHandle());
+
+    try {
+        if (engine.opts.mode == Eryn::EngineMode::NORMAL) {
+            Eryn::NormalBridge bridge({ env, info[1].As<Napi::Value>(), info[2].As<Napi::Object>(), info[3].As<Napi::Value>(),
+                                        info[4].As<Napi::Function>(), info[5].As<Napi::Function>() });
+
+            engine.render_scatter(bridge, absPath.c_str(), handle->output, is_frozen(info[3]), get_timeout(info, 6));
+        } else {
+            Eryn::StrictBridge bridge({ env, info[1].As<Napi::Value>(), info[2].As<Napi::Object>(), info[3].As<Napi::Value>(),
+                                        info[4].As<Napi::Function>(), info[5].As<Napi::Function>() });
+
+            engine.render_scatter(bridge, absPath.c_str(), handle->output, false, get_timeout(info, 6));
+        }
+    } catch (std::exception& e) {
+        throw rendering_error(env, absPath, e);
+    }
+
+    auto& segments = handle->output.segments;
+    auto  result   = Napi::Array::New(env, segments.size());
+
+    if (segments.empty()) {
+        return result;
+    }
+
+    // Every buffer holds a reference to the handle; the last one to be collected deletes it.
+    handle->references = segments.size();
+
+    auto owner = handle.release();
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        auto data = const_cast<uint8_t*>(owner->output.data(segments[i]));
+
+        result.Set(static_cast<uint32_t>(i), Napi::Buffer<uint8_t>::New(env, data, segments[i].size, finalize_segment, owner));
+    }
+
+    return result;
+}
+
+// Returns the size of the output if it fits in the target (after the offset). Otherwise, the target is filled,
+// and the rest of the output is returned as a buffer.
+Napi::Value ErynEngine::render_into(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+
+    auto pathString = info[0].As<Napi::String>().Utf8Value();
+    auto absPath    = path::append_or_absolute(engine.opts.workingDir, pathString);
+    path::normalize(absPath);
+
+    auto target = info[7].As<Napi::Buffer<uint8_t>>();
+    auto offset = static_cast<size_t>(info[8].As<Napi::Number>().Int64Value());
+
+    Buffer overflow;
+    size_t size;
+
+    try {
+        if (engine.opts.mode == Eryn::EngineMode::NORMAL) {
+            Eryn::NormalBridge bridge({ env, info[1].As<Napi::Value>(), info[2].As<Napi::Object>(), info[3].As<Napi::Value>(),
+                                        info[4].As<Napi::Function>(), info[5].As<Napi::Function>() });
+
+            size = engine.render_into(bridge, absPath.c_str(), target.Data() + offset, target.Length() - offset, overflow, is_frozen(info[3]),
+                                      get_timeout(info, 6));
+        } else {
+            Eryn::StrictBridge bridge({ env, info[1].As<Napi::Value>(), info[2].As<Napi::Object>(), info[3].As<Napi::Value>(),
+                                        info[4].As<Napi::Function>(), info[5].As<Napi::Function>() });
+
+            size = engine.render_into(bridge, absPath.c_str(), target.Data() + offset, target.Length() - offset, overflow, false,
+                                      get_timeout(info, 6));
+        }
+    } catch (std::exception& e) {
+        throw rendering_error(env, absPath, e);
+    }
+
+    if (overflow.size == 0) {
+        return Napi::Number::New(env, static_cast<double>(size));
+    }
+
+    std::shared_ptr<const uint8_t> owner;
+    return to_js_buffer(env, overflow.finalize(), owner);
+}
+
+// Renders a list of {path, context, shared} items with one bridge. Returns a buffer for each item, or (when joined)
+// a single buffer and the offsets of the items in it (with the end of the buffer as the last offset).
+Napi::Value ErynEngine::render_many(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+
+    auto list          = info[0].As<Napi::Array>();
+    auto joined        = info[3].ToBoolean().Value();
+    auto defaultShared = info[5].As<Napi::Value>();
+    auto shareStatic   = info[6].ToBoolean().Value();
+    auto normal        = engine.opts.mode == Eryn::EngineMode::NORMAL;
+
+    std::vector<Eryn::BatchItem> items(list.Length());
+
+    for (uint32_t i = 0; i < list.Length(); ++i) {
+        auto item  = list.Get(i).As<Napi::Object>();
+        auto& data = items[i];
+
+        data.path = path::append_or_absolute(engine.opts.workingDir, item.Get("path").As<Napi::String>().Utf8Value());
+        path::normalize(data.path);
+
+        data.context = item.Get("context");
+        data.shared  = item.Has("shared") && !item.Get("shared").IsUndefined() ? item.Get("shared") : defaultShared;
+        data.frozen  = normal && is_frozen(data.shared);
+    }
+
+    std::vector<Eryn::BatchOutput> outputs;
+    Buffer joinedOutput;
+    size_t failed = 0;
+
+    try {
+        if (normal) {
+            Eryn::NormalBridge bridge({ env, env.Undefined(), Napi::Object::New(env), defaultShared, info[1].As<Napi::Function>(),
+                                        info[2].As<Napi::Function>() });
+
+            engine.render_many(bridge, items, joined ? &joinedOutput : nullptr, outputs, failed, shareStatic, get_timeout(info, 4));
+        } else {
+            Eryn::StrictBridge bridge({ env, env.Undefined(), Napi::Object::New(env), defaultShared, info[1].As<Napi::Function>(),
+                                        info[2].As<Napi::Function>() });
+
+            engine.render_many(bridge, items, joined ? &joinedOutput : nullptr, outputs, failed, shareStatic, get_timeout(info, 4));
+        }
+    } catch (std::exception& e) {
+        throw rendering_error(env, failed < items.size() ? items[failed].path : std::string(), e);
+    }
+
+    if (joined) {
+        auto offsets = Napi::Array::New(env, outputs.size() + 1);
+        size_t offset = 0;
+
+        for (uint32_t i = 0; i < outputs.size(); ++i) {
+            offsets.Set(i, Napi::Number::New(env, static_cast<double>(offset)));
+            offset += outputs[i].data.size;
+        }
+
+        offsets.Set(static_cast<uint32_t>(outputs.size()), Napi::Number::New(env, static_cast<double>(offset)));
+
+        std::shared_ptr<const uint8_t> owner;
+        auto result = Napi::Object::New(env);
+
+        result.Set("buffer", to_js_buffer(env, joinedOutput.finalize(), owner));
+        result.Set("offsets", offsets);
+
+        return result;
     }
+
+    auto result = Napi::Array::New(env, outputs.size());
+
+    for (uint32_t i = 0; i < outputs.size(); ++i) {
+        result.Set(i, to_js_buffer(env, outputs[i].data, outputs[i].owner, outputs[i].capacity));
+    }
+
+    return result;
 }
 
+// Renders a list of { path, data, output } items to files (the data and output paths must be absolute).
+// Returns the stats of the build (see Eryn::SiteStats).
+Napi::Value ErynEngine::build_site(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+
+    auto list   = info[0].As<Napi::Array>();
+    auto shared = info[1].As<Napi::Value>();
+    auto normal = engine.opts.mode == Eryn::EngineMode::NORMAL;
+
+    std::vector<Eryn::SiteItem> items(list.Length());
+
+    for (uint32_t i = 0; i < list.Length(); ++i) {
+        auto item  = list.Get(i).As<Napi::Object>();
+        auto& site = items[i];
+
+        site.path = path::append_or_absolute(engine.opts.workingDir, item.Get("path").As<Napi::String>().Utf8Value());
+        path::normalize(site.path);
+
+        if (item.Get("data").IsString()) {
+            site.data = item.Get("data").As<Napi::String>().Utf8Value();
+        }
+
+        site.output = item.Get("output").As<Napi::String>().Utf8Value();
+    }
+
+    auto skipUnchanged = info[4].ToBoolean().Value();
+
+    Eryn::SiteStats stats;
+    size_t failed = 0;
+
+    try {
+        if (normal) {
+            Eryn::NormalBridge bridge({ env, env.Undefined(), Napi::Object::New(env), shared, info[2].As<Napi::Function>(), info[3].As<Napi::Function>() });
+
+            stats = engine.build_site(bridge, items, skipUnchanged, is_frozen(shared), failed);
+        } else {
+            Eryn::StrictBridge bridge({ env, env.Undefined(), Napi::Object::New(env), shared, info[2].As<Napi::Function>(), info[3].As<Napi::Function>() });
+
+            stats = engine.build_site(bridge, items, skipUnchanged, false, failed);
+        }
+    } catch (std::exception& e) {
+        throw rendering_error(env, failed < items.size() ? items[failed].path : std::string(), e);
+    }
+
+    auto result = Napi::Object::New(env);
+
+    result.Set("rendered", Napi::Number::New(env, static_cast<double>(stats.rendered)));
+    result.Set("written", Napi::Number::New(env, static_cast<double>(stats.written)));
+    result.Set("skipped", Napi::Number::New(env, static_cast<double>(stats.skipped)));
+    result.Set("bytes", Napi::Number::New(env, static_cast<double>(stats.bytes)));
+
+    return result;
+}
+
+Napi::Value ErynEngine::render_stream(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+
+    auto pathString = info[0].As<Napi::String>().Utf8Value();
+    auto absPath    = path::append_or_absolute(engine.opts.workingDir, pathString);
+    path::normalize(absPath);
+
+    auto chunkSize = static_cast<size_t>(info[6].As<Napi::Number>().Int64Value());
+    auto timeSlice = info.Length() > 7 ? static_cast<uint64_t>(info[7].As<Napi::Number>().Int64Value()) : 0;
+
+    std::unique_ptr<StreamHandle> handle(new StreamHandle());
+    handle->path = absPath;
+
+    try {
+        if (engine.opts.mode == Eryn::EngineMode::NORMAL) {
+            std::unique_ptr<Eryn::Bridge> bridge(new Eryn::NormalBridge({ env, info[1].As<Napi::Value>(), info[2].As<Napi::Object>(), info[3].As<Napi::Value>(),
+                                                                          info[4].As<Napi::Function>(), info[5].As<Napi::Function>() }));
+
+            handle->stream.reset(new Eryn::RenderStream(engine, std::move(bridge), absPath.c_str(), chunkSize, is_frozen(info[3])));
+        } else {
+            std::unique_ptr<Eryn::Bridge> bridge(new Eryn::StrictBridge({ env, info[1].As<Napi::Value>(), info[2].As<Napi::Object>(), info[3].As<Napi::Value>(),
+                                                                          info[4].As<Napi::Function>(), info[5].As<Napi::Function>() }));
+
+            handle->stream.reset(new Eryn::RenderStream(engine, std::move(bridge), absPath.c_str(), chunkSize));
+        }
+    } catch (std::exception& e) {
+        throw rendering_error(env, absPath, e);
+    }
+
+    handle->stream->set_time_slice(timeSlice);
+    handle->stream->set_timeout(get_timeout(info, 8));
+
+    auto stash = Napi::Array::New(env);
+    Eryn::BridgeStash saving(stash, false);
+
+    handle->stream->stash(saving);
+    handle->stash = Napi::Persistent(stash);
+
+    return Napi::External<StreamHandle>::New(env, handle.release(), finalize_stream);
+}
+
+// Returns the next chunk of a stream (as a copy, since the stream reuses its buffer), or null if the render is done.
+// For streams without chunks, returns undefined until the render is done, and then the whole output.
+Napi::Value ErynEngine::stream_next(const Napi::CallbackInfo& info) {
+    auto env    = info.Env();
+    auto handle = info[0].As<Napi::External<StreamHandle>>().Data();
+    auto stream = handle->stream.get();
+
+    if (stream->done()) {
+        return env.Null();
+    }
+
+    Eryn::BridgeStash restoring(handle->stash.Value().As<Napi::Array>(), true);
+    stream->stash(restoring);
+
+    ConstBuffer chunk;
+
+    try {
+        stream->next(chunk);
+    } catch (std::exception& e) {
+        handle->stash.Reset();
+        throw rendering_error(env, handle->path, e);
+    }
+
+    if (!stream->done()) {
+        Eryn::BridgeStash saving(handle->stash.Value().As<Napi::Array>(), false);
+        stream->stash(saving);
+
+        if (!stream->chunked()) {
+            return env.Undefined();
+        }
+    } else {
+        handle->stash.Reset();
+
+        if (!stream->chunked()) {
+            std::shared_ptr<const uint8_t> owner;
+            return to_js_buffer(env, stream->take(), owner);
+        }
+
+        if (chunk.size == 0) {
+            return env.Null();
+        }
+    }
+
+    return Napi::Buffer<uint8_t>::Copy(env, chunk.data, chunk.size);
+}
+
+Napi::Value ErynEngine::freeze_shared(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+
+    if (info.Length() > 0 && info[0].IsObject()) {
+        frozenShared = Napi::Persistent(info[0].As<Napi::Object>());
+    } else {
+        frozenShared.Reset();
+    }
+
+    engine.freeze_shared();
+
+    return env.Undefined();
+}
+
+bool ErynEngine::is_frozen(const Napi::Value& shared) const {
+    return !frozenShared.IsEmpty() && shared.StrictEquals(frozenShared.Value());
+}
+
+// Returns the statistics of the output pool of this thread (see Eryn::OutputPool).
+Napi::Value output_pool_stats(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+
+    auto& stats  = Eryn::OutputPool::local().stats();
+    auto  result = Napi::Object::New(env);
+
+    result.Set("hits", Napi::Number::New(env, static_cast<double>(stats.hits)));
+    result.Set("misses", Napi::Number::New(env, static_cast<double>(stats.misses)));
+    result.Set("recycled", Napi::Number::New(env, static_cast<double>(stats.recycled)));
+    result.Set("freed", Napi::Number::New(env, static_cast<double>(stats.freed)));
+    result.Set("blocks", Napi::Number::New(env, static_cast<double>(stats.blocks)));
+    result.Set("bytes", Napi::Number::New(env, static_cast<double>(stats.bytes)));
+    result.Set("external", Napi::Number::New(env, static_cast<double>(stats.external)));
+
+    return result;
+}
+
+#ifdef REMEM_ENABLE_MAPPING
+// Returns the allocations recorded by remem since the last reset, grouped by 'who' tag.
+Napi::Value memory_stats(const Napi::CallbackInfo& info) {
+    auto env = info.Env();
+
+    auto result = Napi::Object::New(env);
+    auto tags   = Napi::Object::New(env);
+
+    size_t count = 0;
+    size_t bytes = 0;
+
+    for (const auto& entry : re::mem_stats()) {
+        auto tag = Napi::Object::New(env);
+
+        tag.Set("count", Napi::Number::New(env, static_cast<double>(entry.second.count)));
+        tag.Set("bytes", Napi::Number::New(env, static_cast<double>(entry.second.bytes)));
+        tags.Set(entry.first, tag);
+
+        count += entry.second.count;
+        bytes += entry.second.bytes;
+    }
+
+    result.Set("count", Napi::Number::New(env, static_cast<double>(count)));
+    result.Set("bytes", Napi::Number::New(env, static_cast<double>(bytes)));
+    result.Set("live", Napi::Number::New(env, static_cast<double>(re::mem_size())));
+    result.Set("who", tags);
+
+    return result;
+}
+
+Napi::Value reset_memory_stats(const Napi::CallbackInfo& info) {
+    re::mem_stats_reset();
+    return info.Env().Undefined();
+}
+#endif
+
 void destroy(void*) {
     LOG_DEBUG("Destroying...");
 
+    Eryn::OutputPool::local().clear();
+
 #ifdef REMEM_ENABLE_MAPPING
     re::mem_print();
 #endif
@@ -352,6 +937,13 @@ Napi::Object init(Napi::Env env, Napi::Object exports) {
 
     ErynEngine::Init(env, exports);
 
+    exports.Set("outputPoolStats", Napi::Function::New(env, output_pool_stats));
+
+#ifdef REMEM_ENABLE_MAPPING
+    exports.Set("memoryStats", Napi::Function::New(env, memory_stats));
+    exports.Set("resetMemoryStats", Napi::Function::New(env, reset_memory_stats));
+#endif
+
     napi_add_env_cleanup_hook((napi_env) env, destroy, nullptr);
 
     return exports;
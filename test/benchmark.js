@@ -0,0 +1,63 @@
+// Measures how long it takes to compile large templates (see README.md).
+
+var eryn = require("../index.js")();
+
+// Many small templates, which stresses the delimiter search and the template dispatch.
+function manyTemplates(count) {
+    let source = "";
+
+    for(let i = 0; i < count; ++i) {
+        if(i % 3 === 0) {
+            source += `[|? context.flag|]<p>item ${i}</p>[|end|]\n`;
+        } else {
+            source += `<div class="row">[|context.value + ${i}|]</div>\n`;
+        }
+    }
+
+    return source;
+}
+
+// Mostly plaintext (with brackets, which start a delimiter search), and a single template.
+function mostlyPlaintext(lines) {
+    let half = "";
+
+    for(let i = 0; i < lines / 2; ++i) {
+        half += `<p class="text">Lorem ipsum dolor sit amet, consectetur [adipiscing] elit ${i}.</p>\n`;
+    }
+
+    return half + "[|context.value|]" + half;
+}
+
+// Returns the median and the fastest time of a compile (in ms), out of 'rounds' rounds of 'count' compiles.
+function measure(alias, source, rounds, count) {
+    for(let i = 0; i < count; ++i) {
+        eryn.compileString(alias, source);
+    }
+
+    let times = [];
+
+    for(let round = 0; round < rounds; ++round) {
+        let start = process.hrtime.bigint();
+
+        for(let i = 0; i < count; ++i) {
+            eryn.compileString(alias, source);
+        }
+
+        times.push(Number(process.hrtime.bigint() - start) / count / 1e6);
+    }
+
+    times.sort((a, b) => a - b);
+
+    return { median: times[Math.floor(times.length / 2)], fastest: times[0] };
+}
+
+const cases = [
+    ["3000 templates", manyTemplates(3000)],
+    ["1.3 MB plaintext", mostlyPlaintext(16000)]
+];
+
+for(const [name, source] of cases) {
+    let result = measure(name, source, 41, 20);
+
+    console.log(`${name}: ${result.median.toFixed(3)} ms (fastest ${result.fastest.toFixed(3)} ms)`);
+}
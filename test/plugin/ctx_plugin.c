@@ -0,0 +1,48 @@
+/*
+ * A compile hook plugin for the tests. Like the batched hook in test.js, it replaces '{{greeting}}' in plaintext,
+ * and rewrites 'ctx.' to 'context.' in all other segments except comments.
+ */
+
+#include <string.h>
+
+#include "eryn_plugin.h"
+
+static int is_token_char(uint8_t c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$';
+}
+
+/* Writes the input with every occurrence of the pattern replaced. If 'whole' is set, occurrences that
+ * continue a token or a property access (e.g. 'myctx.' or 'a.ctx.') are kept. */
+static void replace_all(const uint8_t* in, size_t in_len, const char* pattern, const char* replacement, int whole, eryn_writer* out) {
+    size_t length = strlen(pattern);
+    size_t start  = 0;
+    size_t i;
+
+    for(i = 0; i + length <= in_len; ++i) {
+        if(memcmp(in + i, pattern, length) != 0 || (whole && i > 0 && (is_token_char(in[i - 1]) || in[i - 1] == '.'))) {
+            continue;
+        }
+
+        out->write(out->target, in + start, i - start);
+        out->write(out->target, (const uint8_t*) replacement, strlen(replacement));
+
+        start = i + length;
+        i    += length - 1;
+    }
+
+    out->write(out->target, in + start, in_len - start);
+}
+
+ERYN_PLUGIN_EXPORT int transform(const char* origin, const uint8_t* in, size_t in_len, eryn_writer* out) {
+    if(strcmp(origin, "comment") == 0) {
+        return ERYN_TRANSFORM_KEEP;
+    }
+
+    if(strcmp(origin, "plaintext") == 0) {
+        replace_all(in, in_len, "{{greeting}}", "Hello", 0, out);
+    } else {
+        replace_all(in, in_len, "ctx.", "context.", 1, out);
+    }
+
+    return ERYN_TRANSFORM_REPLACE;
+}
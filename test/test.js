@@ -13,6 +13,61 @@ eryn.setOptions({
     workingDirectory: path.join(__dirname, 'input')
 });
 
+// Used for the tests that need a differently configured engine.
+var erynOptimized = require("../index.js")({
+    inlineStaticComponents: true,
+    mergePlaintext: true,
+    foldConstants: true,
+    defines: {
+        FEATURE_NEW_NAV: true,
+        REGION: "eu"
+    },
+    workingDirectory: path.join(__dirname, 'input')
+});
+
+var erynMinified = require("../index.js")({
+    minifyHTML: true,
+    workingDirectory: path.join(__dirname, 'input')
+});
+
+// Rewrites 'ctx' to 'context' in all segments of a file with a single hook call.
+var erynBatchedHook = require("../index.js")({
+    batchCompileHook: true,
+    memoizeCompileHook: true,
+    compileHook: (segments) => segments.map(segment => {
+        if(segment.origin === 'comment') {
+            return undefined;
+        }
+        if(segment.origin === 'plaintext') {
+            return segment.content.toString().replace(/\{\{greeting\}\}/g, 'Hello');
+        }
+
+        return segment.content.toString().replace(/\bctx\./g, 'context.');
+    }),
+    workingDirectory: path.join(__dirname, 'input')
+});
+
+var erynMemoized = require("../index.js")({
+    memoizeComponents: true,
+    workingDirectory: path.join(__dirname, 'input')
+});
+
+var outputPoolStats = require("../index.js").outputPoolStats;
+
+// Only available when the addon is built with ERYN_MEMORY_STATS.
+var memoryStats = require("../index.js").memoryStats;
+var resetMemoryStats = require("../index.js").resetMemoryStats;
+
+// Kept separate so that the OSH dumps of the main engine don't show up in the allocation counts.
+var erynAllocations = require("../index.js")({
+    workingDirectory: path.join(__dirname, 'input')
+});
+
+erynOptimized.freezeShared({
+    site: { name: "Eryn" },
+    features: { nav: true }
+});
+
 // This is where the output files will be written.
 const OUTPUT_DIR = path.join(__dirname, "actual");
 
@@ -23,6 +78,36 @@ if(fs.existsSync(OUTPUT_DIR)){
     fs.mkdirSync(OUTPUT_DIR, { recursive: true });
 }
 
+// Builds the plugin in test/plugin with the system C compiler. Returns null if it can't be built (e.g. no compiler).
+function buildTestPlugin(name) {
+    if(process.platform === 'win32') {
+        return null;
+    }
+
+    let output = path.join(OUTPUT_DIR, `${name}${process.platform === 'darwin' ? '.dylib' : '.so'}`);
+
+    try {
+        require("child_process").execFileSync(process.env.CC || 'cc', [
+            '-shared', '-fPIC',
+            '-I', path.join(__dirname, '..', 'include'),
+            path.join(__dirname, 'plugin', `${name}.c`),
+            '-o', output
+        ], { stdio: 'ignore' });
+
+        return output;
+    } catch(ex) {
+        return null;
+    }
+}
+
+var pluginPath = buildTestPlugin('ctx_plugin');
+
+// Does the same as erynBatchedHook, through a native plugin.
+var erynPlugin = pluginPath && require("../index.js")({
+    compileHook: pluginPath,
+    workingDirectory: path.join(__dirname, 'input')
+});
+
 function oshTestFactory(name) {
     return () => {
         try {
@@ -47,10 +132,10 @@ function oshTestFactory(name) {
     }
 }
 
-function renderTestFactory(name) {
+function renderTestFactory(name, engine = eryn) {
     return () => {
         try {
-            let result = eryn.render(`${name}.eryn`, {
+            let result = engine.render(`${name}.eryn`, {
                 conditional_one: 1,
                 loop_numbers: [0, 1, 2, 3, 4]
             });
@@ -78,6 +163,438 @@ function renderTestFactory(name) {
     }
 }
 
+// Renders enough times to warm up the engine (compilation, scratch memory), then checks that the
+// average number of tracked allocations per render stays within the budget.
+// Set ERYN_ALLOCATION_REPORT to print the per-tag breakdown for every test, not just the failing ones.
+const ALLOCATION_WARMUP = 8;
+const ALLOCATION_RENDERS = 100;
+
+function allocationTestFactory(name, budget, engine = erynAllocations) {
+    return () => {
+        try {
+            let context = {
+                conditional_one: 1,
+                loop_numbers: [0, 1, 2, 3, 4]
+            };
+
+            for(let i = 0; i < ALLOCATION_WARMUP; ++i) {
+                engine.render(`${name}.eryn`, context);
+            }
+
+            resetMemoryStats();
+
+            for(let i = 0; i < ALLOCATION_RENDERS; ++i) {
+                engine.render(`${name}.eryn`, context);
+            }
+
+            let stats = memoryStats();
+            let perRender = stats.count / ALLOCATION_RENDERS;
+
+            if(perRender > budget || process.env.ERYN_ALLOCATION_REPORT) {
+                console.log(`${name}: ${perRender} allocation(s), ${stats.bytes / ALLOCATION_RENDERS} byte(s) per render (budget: ${budget})`);
+
+                for(const who in stats.who) {
+                    console.log(`    ${who}: ${stats.who[who].count / ALLOCATION_RENDERS} allocation(s), ${stats.who[who].bytes / ALLOCATION_RENDERS} byte(s)`);
+                }
+            }
+
+            return perRender <= budget;
+        } catch(ex) {
+            console.error(ex);
+            return false;
+        }
+    }
+}
+
+// Renders the file as segments, recompiles it (which replaces the cached OSH that the segments point into),
+// and only then compares the joined segments with the expected output.
+function segmentsTestFactory(name, engine = eryn) {
+    return () => {
+        try {
+            let segments = engine.renderSegments(`${name}.eryn`, {
+                conditional_one: 1,
+                loop_numbers: [0, 1, 2, 3, 4]
+            });
+
+            engine.compile(`${name}.eryn`);
+            fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+
+            let expected = fs.readFileSync(path.join(__dirname, `expected/${name}.eryn.rendered`));
+
+            return Buffer.concat(segments).equals(expected);
+        } catch(ex) {
+            console.error(ex);
+            return false;
+        }
+    }
+}
+
+function streamTestFactory(name, chunkSize, engine = eryn) {
+    return () => {
+        try {
+            let stream = engine.renderStream(`${name}.eryn`, {
+                conditional_one: 1,
+                loop_numbers: [0, 1, 2, 3, 4]
+            }, undefined, { chunkSize: chunkSize });
+
+            let chunks = [];
+            let chunk;
+
+            while((chunk = stream.read()) !== null)
+                chunks.push(chunk);
+
+            fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+
+            let expected = fs.readFileSync(path.join(__dirname, `expected/${name}.eryn.rendered`));
+
+            return chunks.length > 1 && Buffer.concat(chunks).equals(expected);
+        } catch(ex) {
+            console.error(ex);
+            return false;
+        }
+    }
+}
+
+// jshiyou tests are synchronous, so the checks that need the event loop run before the tests (see the end of the file),
+// and the tests only look at their results.
+const asyncChecks = [];
+
+// Renders a large loop with renderAsync, and counts the setImmediate and timer callbacks that run before it's done.
+async function runAsyncRender(name, engine = eryn) {
+    const context = {
+        conditional_one: 1,
+        loop_numbers: Array.from({ length: 200000 }, (_, i) => i)
+    };
+
+    let immediates = 0;
+    let timers = 0;
+    let done = false;
+
+    const countImmediate = () => {
+        if(!done) {
+            ++immediates;
+            setImmediate(countImmediate);
+        }
+    };
+    const countTimer = () => {
+        if(!done) {
+            ++timers;
+            setTimeout(countTimer, 0);
+        }
+    };
+
+    setImmediate(countImmediate);
+    setTimeout(countTimer, 0);
+
+    try {
+        const result = await engine.renderAsync(`${name}.eryn`, context, undefined, { timeSlice: 1 });
+        done = true;
+
+        return { equal: result.equals(engine.render(`${name}.eryn`, context)), immediates, timers };
+    } catch(ex) {
+        console.error(ex);
+        return { equal: false, immediates, timers };
+    } finally {
+        done = true;
+        fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+    }
+}
+
+function asyncTestFactory(name, engine = eryn) {
+    let result = null;
+
+    asyncChecks.push(async () => {
+        result = await runAsyncRender(name, engine);
+    });
+
+    return () => result !== null && result.equal && result.immediates > 0 && result.timers > 0;
+}
+
+// Drops rendered buffers and collects them, so that their outputs go back to the pool, and checks that the next render reuses one.
+// Returns the pool stats before, after collecting, and after rendering again.
+async function runOutputPoolCheck(name, engine = eryn) {
+    require("v8").setFlagsFromString('--expose-gc');
+    const gc = global.gc || require("vm").runInNewContext('gc');
+
+    const context = {
+        conditional_one: 1,
+        loop_numbers: [0, 1, 2, 3, 4]
+    };
+
+    try {
+        engine.render(`${name}.eryn`, context);
+
+        const before = outputPoolStats();
+
+        for(let i = 0; i < 4; ++i) {
+            engine.render(`${name}.eryn`, context);
+        }
+
+        // The finalizers of the buffers may run after the collection.
+        for(let i = 0; i < 4 && outputPoolStats().recycled === before.recycled; ++i) {
+            gc();
+            await new Promise(resolve => setImmediate(resolve));
+        }
+
+        const collected = outputPoolStats();
+
+        engine.render(`${name}.eryn`, context);
+
+        return { before, collected, after: outputPoolStats() };
+    } catch(ex) {
+        console.error(ex);
+        return null;
+    } finally {
+        fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+    }
+}
+
+function outputPoolTestFactory(name, engine = eryn) {
+    let result = null;
+
+    asyncChecks.push(async () => {
+        result = await runOutputPoolCheck(name, engine);
+    });
+
+    return () => result !== null && result.collected.recycled > result.before.recycled && result.after.hits > result.collected.hits;
+}
+
+// Drops a rendered buffer that is larger than the largest pool class and collects it. Its output must be freed, not pooled.
+// Returns the pool stats before rendering and after collecting.
+async function runLargeOutputCheck(name, engine = eryn) {
+    require("v8").setFlagsFromString('--expose-gc');
+    const gc = global.gc || require("vm").runInNewContext('gc');
+
+    const context = {
+        conditional_one: 1,
+        loop_numbers: Array.from({ length: 200000 }, (_, i) => i)
+    };
+
+    try {
+        // Collects the buffers of the previous checks first, so that they don't change the stats.
+        for(let i = 0; i < 4; ++i) {
+            gc();
+            await new Promise(resolve => setImmediate(resolve));
+        }
+
+        const before = outputPoolStats();
+
+        if(engine.render(`${name}.eryn`, context).length <= 1024 * 1024)
+            return null;
+
+        for(let i = 0; i < 4 && outputPoolStats().freed === before.freed; ++i) {
+            gc();
+            await new Promise(resolve => setImmediate(resolve));
+        }
+
+        return { before, collected: outputPoolStats() };
+    } catch(ex) {
+        console.error(ex);
+        return null;
+    } finally {
+        fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+    }
+}
+
+function largeOutputTestFactory(name, engine = eryn) {
+    let result = null;
+
+    asyncChecks.push(async () => {
+        result = await runLargeOutputCheck(name, engine);
+    });
+
+    return () => result !== null && result.collected.freed > result.before.freed && result.collected.bytes <= result.before.bytes;
+}
+
+function intoTestFactory(name, targetSize, engine = eryn) {
+    return () => {
+        try {
+            let target = Buffer.alloc(targetSize);
+            let rest = [];
+
+            let written = engine.renderInto(`${name}.eryn`, {
+                conditional_one: 1,
+                loop_numbers: [0, 1, 2, 3, 4]
+            }, target, 8, undefined, { overflow: (buffer) => rest.push(buffer) });
+
+            fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+
+            let expected = fs.readFileSync(path.join(__dirname, `expected/${name}.eryn.rendered`));
+
+            return Buffer.concat([target.subarray(8, 8 + written), ...rest]).equals(expected);
+        } catch(ex) {
+            console.error(ex);
+            return false;
+        }
+    }
+}
+
+// Every item of the batch must match its own render, whether the outputs are separate or concatenated.
+function batchTestFactory(names, concat, engine = eryn) {
+    return () => {
+        try {
+            let items = names.map((name) => ({
+                path: `${name}.eryn`,
+                context: {
+                    conditional_one: 1,
+                    loop_numbers: [0, 1, 2, 3, 4]
+                }
+            }));
+
+            let result = engine.renderMany(items, { concat });
+
+            for(const name of names) {
+                fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+            }
+
+            let outputs = concat ? names.map((_, i) => result.buffer.subarray(result.offsets[i], result.offsets[i + 1])) : result;
+
+            return outputs.length === names.length && names.every((name, i) =>
+                outputs[i].equals(fs.readFileSync(path.join(__dirname, `expected/${name}.eryn.rendered`))));
+        } catch(ex) {
+            console.error(ex);
+            return false;
+        }
+    }
+}
+
+// The pages are written to the output directory, and a second build skips them since they didn't change.
+function siteTestFactory(names, engine = eryn) {
+    return () => {
+        try {
+            let dataFile = path.join(OUTPUT_DIR, 'site.json');
+
+            fs.writeFileSync(dataFile, JSON.stringify({
+                conditional_one: 1,
+                loop_numbers: [0, 1, 2, 3, 4]
+            }));
+
+            let manifest = names.map((name, i) => ({
+                template: `${name}.eryn`,
+                data: dataFile,
+                output: path.join(OUTPUT_DIR, `site/${i}/${path.basename(name)}.html`)
+            }));
+
+            let first = engine.buildSite(manifest);
+            let second = engine.buildSite(manifest);
+
+            for(const name of names) {
+                fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+            }
+
+            return first.written === names.length && second.skipped === names.length && second.written === 0 &&
+                   manifest.every((page, i) => fs.readFileSync(page.output).equals(fs.readFileSync(path.join(__dirname, `expected/${names[i]}.eryn.rendered`))));
+        } catch(ex) {
+            console.error(ex);
+            return false;
+        }
+    }
+}
+
+// Rendered buffers are reported to V8 as external memory (at least their size) until they are collected.
+function externalMemoryTestFactory(name, engine = eryn) {
+    return () => {
+        try {
+            let before = outputPoolStats().external;
+
+            let result = engine.render(`${name}.eryn`, {
+                conditional_one: 1,
+                loop_numbers: [0, 1, 2, 3, 4]
+            });
+
+            fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+
+            return outputPoolStats().external - before >= result.length;
+        } catch(ex) {
+            console.error(ex);
+            return false;
+        }
+    }
+}
+
+// The buffer returned by render is the caller's, so changing it must not change the next renders (even for static templates).
+// With shareStatic, it points into the cache instead (and is only checked for its content).
+function ownedOutputTestFactory(name, engine = eryn) {
+    return () => {
+        try {
+            let expected = fs.readFileSync(path.join(__dirname, `expected/${name}.eryn.rendered`));
+
+            engine.render(`${name}.eryn`, {}).fill(0);
+
+            let result = engine.render(`${name}.eryn`, {});
+            let shared = engine.render(`${name}.eryn`, {}, undefined, { shareStatic: true });
+
+            return result.equals(expected) && shared.equals(expected);
+        } catch(ex) {
+            console.error(ex);
+            return false;
+        } finally {
+            fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+        }
+    }
+}
+
+// Renders a side-effect free component several times with the same context, and counts how many times its template reads
+// the context. The property is not enumerable, so it's not part of the memo key, and it's only read when the component
+// is rendered (not when its output is reused).
+function memoCountTestFactory(name, engine = eryn) {
+    return () => {
+        try {
+            let reads = 0;
+            let icon  = { size: 16 };
+
+            Object.defineProperty(icon, 'name', { get: () => { ++reads; return "star"; }, enumerable: false });
+
+            let result = engine.render(`${name}.eryn`, {
+                loop_numbers: [0, 1, 2, 3, 4],
+                icon: icon
+            });
+
+            let expected = fs.readFileSync(path.join(__dirname, `expected/${name}.eryn.rendered`));
+
+            return result.equals(expected) && reads === 1;
+        } catch(ex) {
+            console.error(ex);
+            return false;
+        } finally {
+            fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+        }
+    }
+}
+
+// Loading a plugin that doesn't exist must fail when setting the options, not when compiling.
+function pluginErrorTestFactory(pluginFile) {
+    return () => {
+        try {
+            require("../index.js")({
+                compileHook: path.join(__dirname, 'plugin', pluginFile),
+                workingDirectory: path.join(__dirname, 'input')
+            });
+
+            return false;
+        } catch(ex) {
+            return ex instanceof Error && ex.message.startsWith('Cannot load compile hook plugin');
+        }
+    }
+}
+
+function abortTestFactory(name, engine = eryn) {
+    return () => {
+        try {
+            engine.render(`${name}.eryn`, {
+                conditional_one: 1,
+                loop_numbers: Array.from({ length: 100000 }, (_, i) => i)
+            }, undefined, { timeout: 1 });
+
+            return false;
+        } catch(ex) {
+            return ex.code === 'ERYN_RENDER_ABORTED' && ex.progress.iterations < 100000;
+        } finally {
+            fs.unlink(path.join(__dirname, `input/${name}.eryn.osh`), NOP);
+        }
+    }
+}
+
 shiyou.test('OSH', 'Empty', oshTestFactory('empty'));
 shiyou.test('OSH', 'Plain text', oshTestFactory('plain_text'));
 shiyou.test('OSH', 'Conditional', oshTestFactory('conditional'));
@@ -106,5 +623,46 @@ shiyou.test('Render', 'Component (nested)', renderTestFactory('component_nested/
 shiyou.test('Render', 'Component + content (nested)', renderTestFactory('component_content_nested/component_content_nested'));
 shiyou.test('Render', 'Component + content + plaintext (nested)', renderTestFactory('component_content_plaintext_nested/component_content_plaintext_nested'));
 shiyou.test('Render', 'Mixed', renderTestFactory('mixed/mixed'));
+shiyou.test('Render', 'Component (static)', renderTestFactory('component_static/component_static'));
+shiyou.test('Render', 'Component (memoized)', renderTestFactory('component_memo/component_memo', erynMemoized));
+shiyou.test('Render', 'Component (memoized reads)', memoCountTestFactory('component_memo/component_memo_reads', erynMemoized));
+shiyou.test('Render', 'Component (inlined)', renderTestFactory('component_inline/component_inline', erynOptimized));
+shiyou.test('Render', 'Plaintext (merged)', renderTestFactory('plaintext_merge', erynOptimized));
+shiyou.test('Render', 'Constant folding', renderTestFactory('constant_fold', erynOptimized));
+shiyou.test('Render', 'Defines', renderTestFactory('defines', erynOptimized));
+shiyou.test('Render', 'Shared (frozen)', renderTestFactory('shared_frozen', erynOptimized));
+shiyou.test('Render', 'HTML (minified)', renderTestFactory('minify_html', erynMinified));
+shiyou.test('Render', 'Compile hook (batched)', renderTestFactory('compile_hook_batch', erynBatchedHook));
+shiyou.test('Render', 'Compile hook (batched plaintext)', renderTestFactory('compile_hook_plaintext', erynBatchedHook));
+shiyou.test('Render', 'Compile hook (plugin load error)', pluginErrorTestFactory('missing_plugin.so'));
+shiyou.test('Render', 'Static (owned output)', ownedOutputTestFactory('plain_text'));
+shiyou.test('Render', 'Async', asyncTestFactory('loop'));
+shiyou.test('Render', 'Segments', segmentsTestFactory('segments'));
+shiyou.test('Render', 'Stream', streamTestFactory('mixed/mixed', 64));
+shiyou.test('Render', 'Timeout', abortTestFactory('loop'));
+shiyou.test('Render', 'Into buffer', intoTestFactory('mixed/mixed', 4096));
+shiyou.test('Render', 'Into buffer (overflow)', intoTestFactory('mixed/mixed', 512));
+shiyou.test('Render', 'Batch', batchTestFactory(['mixed/mixed', 'loop', 'plain_text', 'mixed/mixed'], false));
+shiyou.test('Render', 'Batch (concat)', batchTestFactory(['mixed/mixed', 'loop', 'plain_text', 'mixed/mixed'], true));
+shiyou.test('Render', 'Site', siteTestFactory(['mixed/mixed', 'loop', 'plain_text', 'component/component']));
+shiyou.test('Render', 'External memory', externalMemoryTestFactory('mixed/mixed'));
+shiyou.test('Render', 'Output pool', outputPoolTestFactory('mixed/mixed'));
+shiyou.test('Render', 'Output pool (large output)', largeOutputTestFactory('loop'));
+
+// Only when a C compiler is available.
+if(erynPlugin) {
+    shiyou.test('Render', 'Compile hook (plugin)', renderTestFactory('compile_hook_batch', erynPlugin));
+    shiyou.test('Render', 'Compile hook (plugin plaintext)', renderTestFactory('compile_hook_plaintext', erynPlugin));
+}
+
+if(memoryStats) {
+    shiyou.test('Allocations', 'Plain text', allocationTestFactory('plain_text', 1));
+    shiyou.test('Allocations', 'Loop', allocationTestFactory('loop', 1));
+    shiyou.test('Allocations', 'Conditional + else', allocationTestFactory('conditional_else', 1));
+    shiyou.test('Allocations', 'Component', allocationTestFactory('component/component', 1));
+    shiyou.test('Allocations', 'Component (nested)', allocationTestFactory('component_nested/component_nested', 1));
+    shiyou.test('Allocations', 'Mixed', allocationTestFactory('mixed/mixed', 1));
+}
 
-shiyou.run();
\ No newline at end of file
+// One at a time, since they count callbacks and pool blocks.
+asyncChecks.reduce((previous, check) => previous.then(check), Promise.resolve()).then(() => shiyou.run());
\ No newline at end of file